@@ -0,0 +1,63 @@
+#include "arena.h"
+
+namespace synth {
+
+	static const size_t ALIGNMENT = alignof(std::max_align_t);
+
+	RenderArena::RenderArena(size_t chunkSize) : chunkSize(chunkSize) {
+		chunk = 0;
+		used = 0;
+	}
+
+	void* RenderArena::allocate(size_t bytes) {
+		bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+		// oversized requests get an allocation to themselves, released again by reset()
+		if (bytes > chunkSize) {
+			large.emplace_back(new char[bytes]);
+			return large.back().get();
+		}
+
+		while (chunk < chunks.size() && used + bytes > chunkSize) {
+			++chunk;
+			used = 0;
+		}
+		if (chunk == chunks.size()) {
+			chunks.emplace_back(new char[chunkSize]);
+			used = 0;
+		}
+
+		char* memory = chunks[chunk].get() + used;
+		used += bytes;
+		return memory;
+	}
+
+	void RenderArena::reset() {
+		large.clear();
+		chunk = 0;
+		used = 0;
+	}
+
+	size_t RenderArena::capacity() const {
+		return chunks.size() * chunkSize;
+	}
+
+	RenderArena*& RenderArena::currentRef() {
+		static thread_local RenderArena* arena = nullptr;
+		return arena;
+	}
+
+	RenderArena* RenderArena::current() {
+		return currentRef();
+	}
+
+	RenderArena::Scope::Scope(RenderArena& arena) {
+		previous = currentRef();
+		currentRef() = &arena;
+	}
+
+	RenderArena::Scope::~Scope() {
+		currentRef() = previous;
+	}
+
+}
@@ -0,0 +1,69 @@
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace synth {
+
+	/*
+		a bump allocator for the nodes of a render session.
+		while a RenderArena::Scope is alive, Dynamic sources created on that thread
+		that are too big to be stored inline are placed in the arena instead of on
+		the heap. nothing is freed individually, the memory is reused once the
+		session calls reset() or the arena is destroyed, so every Dynamic placed in
+		the arena must be destroyed before that happens.
+
+		usage:
+			RenderArena arena;
+			for (...) {
+				RenderArena::Scope scope(arena);
+				... build and render a patch ...
+				arena.reset(); // once the patch has been destroyed
+			}
+	*/
+	class RenderArena {
+	private:
+		std::vector<std::unique_ptr<char[]>> chunks;
+		std::vector<std::unique_ptr<char[]>> large;
+		size_t chunkSize;
+		size_t chunk; // index of the chunk currently being filled
+		size_t used;  // bytes used in that chunk
+
+		static RenderArena*& currentRef();
+
+	public:
+		RenderArena(size_t chunkSize = 64 * 1024);
+
+		RenderArena(const RenderArena&) = delete;
+		RenderArena& operator = (const RenderArena&) = delete;
+
+		// memory aligned for any type, lives until reset() or the arena is destroyed
+		void* allocate(size_t bytes);
+
+		// makes the chunks available again without returning them to the system,
+		// oversized allocations are freed
+		void reset();
+
+		// bytes held in regular chunks, does not count oversized allocations
+		size_t capacity() const;
+
+		// the arena of the innermost Scope on this thread, or nullptr
+		static RenderArena* current();
+
+		class Scope {
+		private:
+			RenderArena* previous;
+		public:
+			Scope(RenderArena& arena);
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope& operator = (const Scope&) = delete;
+		};
+	};
+
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "asyncwriter.h"
+
+namespace synth {
+
+	AsyncWavFileWriter::AsyncWavFileWriter(const char* fname, const WavFormat& format, size_t slots, size_t slotBytes)
+		: encoder(format), headerBytes(format.headerBytes()),
+		slotBytes(std::max<size_t>(slotBytes / format.frameBytes(), 1) * format.frameBytes()),
+		storage(new char[slots * this->slotBytes]), ring(slots),
+		filling(nullptr), fillingBytes(0), dataBytes(0),
+		finished(false), error(0),
+		slotsQueued(0), bytesWritten(0), writeCalls(0), producerStalls(0), maxOccupancy(0) {
+		fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error(std::string("could not open ") + fname + ": " + strerror(errno));
+		writer = std::thread(&AsyncWavFileWriter::drain, this);
+	}
+
+	AsyncWavFileWriter::~AsyncWavFileWriter() {
+		// a destructor can not throw, call close() to find out whether the file was written
+		try {
+			close();
+		} catch (const std::runtime_error&) {
+		}
+	}
+
+	void AsyncWavFileWriter::writeHeader() {
+		// the sizes are written as 0 for now and filled in by close
+		char header[WAV_MAX_HEADER_BYTES];
+		encodeWavHeader(header, getFormat(), 0);
+		writeAt(header, headerBytes, 0);
+		checkError();
+	}
+
+	void AsyncWavFileWriter::close() {
+		if (fd < 0)
+			return;
+
+		if (filling != nullptr && fillingBytes > 0)
+			publish();
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			finished = true;
+		}
+		dataAvailable.notify_one();
+		writer.join();
+
+		char header[WAV_MAX_HEADER_BYTES];
+		encodeWavHeader(header, getFormat(), dataBytes);
+		writeAt(header, headerBytes, 0);
+		::close(fd);
+		fd = -1;
+		checkError();
+	}
+
+	AsyncWavFileWriter::Stats AsyncWavFileWriter::stats() const {
+		Stats stats;
+		stats.slotsQueued = slotsQueued;
+		stats.bytesWritten = bytesWritten;
+		stats.writeCalls = writeCalls;
+		stats.producerStalls = producerStalls;
+		stats.occupancy = ring.size();
+		stats.maxOccupancy = maxOccupancy;
+		return stats;
+	}
+
+	void AsyncWavFileWriter::checkError() {
+		int failed = error;
+		if (failed)
+			throw std::runtime_error(std::string("could not write wav file: ") + strerror(failed));
+	}
+
+	/*
+		render thread
+	*/
+	char* AsyncWavFileWriter::claim() {
+		if (ring.back() == nullptr) {
+			++producerStalls;
+			std::unique_lock<std::mutex> guard(sleepLock);
+			spaceAvailable.wait(guard, [&] { return ring.back() != nullptr; });
+		}
+		return storage.get() + ring.writePosition() % ring.capacity() * slotBytes;
+	}
+
+	void AsyncWavFileWriter::publish() {
+		*ring.back() = fillingBytes;
+		ring.push();
+		dataBytes += fillingBytes;
+		filling = nullptr;
+		fillingBytes = 0;
+
+		++slotsQueued;
+		size_t occupancy = ring.size();
+		if (occupancy > maxOccupancy)
+			maxOccupancy = occupancy;
+
+		// taking the lock orders the push before the writer thread's check, so the wakeup can not be lost
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		dataAvailable.notify_one();
+	}
+
+	void AsyncWavFileWriter::writeSamples(const float* samples, size_t frames) {
+		checkError();
+		const int channels = getFormat().channels;
+		const size_t frameBytes = getFormat().frameBytes();
+		while (frames > 0) {
+			if (filling == nullptr)
+				filling = claim();
+			size_t count = std::min(frames, (slotBytes - fillingBytes) / frameBytes);
+			encoder.encode(samples, count * channels, filling + fillingBytes);
+			fillingBytes += count * frameBytes;
+			samples += count * channels;
+			frames -= count;
+			if (fillingBytes == slotBytes)
+				publish();
+		}
+	}
+
+	void AsyncWavFileWriter::writeFrames(const float* const* channels, size_t frames) {
+		checkError();
+		const size_t frameBytes = getFormat().frameBytes();
+		offsetChannels.assign(channels, channels + getFormat().channels);
+		while (frames > 0) {
+			if (filling == nullptr)
+				filling = claim();
+			size_t count = std::min(frames, (slotBytes - fillingBytes) / frameBytes);
+			encoder.encodeFrames(offsetChannels.data(), count, filling + fillingBytes);
+			fillingBytes += count * frameBytes;
+			frames -= count;
+			for (const float*& channel : offsetChannels)
+				channel += count;
+			if (fillingBytes == slotBytes)
+				publish();
+		}
+	}
+
+	/*
+		writer thread
+	*/
+	void AsyncWavFileWriter::writeAt(const char* bytes, size_t count, off_t offset) {
+		while (count > 0 && error == 0) {
+			ssize_t written = pwrite(fd, bytes, count, offset);
+			if (written < 0) {
+				if (errno != EINTR)
+					error = errno;
+				continue;
+			}
+			++writeCalls;
+			bytes += written;
+			count -= written;
+			offset += written;
+		}
+	}
+
+	void AsyncWavFileWriter::drain() {
+		off_t offset = headerBytes;
+		for (;;) {
+			size_t count = ring.available();
+			if (count == 0) {
+				std::unique_lock<std::mutex> guard(sleepLock);
+				dataAvailable.wait(guard, [&] { return ring.available() > 0 || finished; });
+				if (ring.available() == 0)
+					return;
+				continue;
+			}
+
+			// published slots are next to each other in storage up to the end of the ring,
+			// a partly filled slot (only the last one, from close) ends the run
+			size_t first = ring.readPosition() % ring.capacity();
+			size_t run = 0;
+			size_t bytes = 0;
+			while (run < count && first + run < ring.capacity()) {
+				size_t used = *ring.peek(run);
+				bytes += used;
+				++run;
+				if (used < slotBytes)
+					break;
+			}
+
+			// after an error the slots are still drained so the render thread never blocks for good
+			writeAt(storage.get() + first * slotBytes, bytes, offset);
+			if (error == 0)
+				bytesWritten += bytes;
+			offset += bytes;
+			ring.pop(run);
+
+			{
+				std::lock_guard<std::mutex> guard(sleepLock);
+			}
+			spaceAvailable.notify_one();
+		}
+	}
+
+}
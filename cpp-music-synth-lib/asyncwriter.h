@@ -0,0 +1,112 @@
+#ifndef __ASYNCWRITER_H_
+#define __ASYNCWRITER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fileformats.h"
+#include "ringbuffer.h"
+
+namespace synth {
+
+	/*
+		a wav writer that keeps the render thread off the file system.
+		samples are encoded straight into the slots of a fixed size ring, and a
+		writer thread of its own drains the ring with one pwrite per run of
+		consecutive slots. the render thread only waits when the ring is full,
+		so short stalls of the disk (or network volume) are absorbed by the ring.
+		memory use is slots * slotBytes however long the render is.
+
+		errors of the writer thread are thrown as std::runtime_error from the
+		next write or from close().
+
+		usage:
+			AsyncWavFileWriter out("song.wav", WavFormat(2));
+			out.writeHeader();
+			out.render(left, right);  // or ParallelRenderer::render(out, song) for mono
+			out.close();
+			out.stats().producerStalls ...
+	*/
+	class AsyncWavFileWriter {
+	public:
+		struct Stats {
+			size_t slotsQueued;    // slots handed to the writer thread
+			size_t bytesWritten;   // sample bytes written to the file so far
+			size_t writeCalls;     // pwrite calls made for them
+			size_t producerStalls; // times the render thread found the ring full and had to wait
+			size_t occupancy;      // slots waiting to be written right now
+			size_t maxOccupancy;   // the most slots that were ever waiting at once
+		};
+
+	private:
+		int fd;
+		WavEncoder encoder;
+		size_t headerBytes;
+		size_t slotBytes; // a whole number of frames
+		std::unique_ptr<char[]> storage;
+		SpscRing<size_t> ring; // the bytes used in each published slot
+
+		// producer side
+		char* filling;      // the slot being filled, nullptr if none is claimed
+		size_t fillingBytes;
+		size_t dataBytes;   // everything handed to the ring so far
+		std::vector<const float*> offsetChannels;
+
+		// writer thread
+		std::thread writer;
+		std::mutex sleepLock;
+		std::condition_variable spaceAvailable;
+		std::condition_variable dataAvailable;
+		std::atomic<bool> finished;
+		std::atomic<int> error;
+
+		std::atomic<size_t> slotsQueued;
+		std::atomic<size_t> bytesWritten;
+		std::atomic<size_t> writeCalls;
+		std::atomic<size_t> producerStalls;
+		std::atomic<size_t> maxOccupancy;
+
+		void drain();
+		void writeAt(const char* bytes, size_t count, off_t offset);
+		void checkError();
+		char* claim();
+		void publish();
+
+	public:
+		// the ring holds slots blocks of about slotBytes each
+		AsyncWavFileWriter(const char* fname, const WavFormat& format = WavFormat(), size_t slots = 16, size_t slotBytes = 256 * 1024);
+		~AsyncWavFileWriter();
+
+		AsyncWavFileWriter(const AsyncWavFileWriter&) = delete;
+		AsyncWavFileWriter& operator = (const AsyncWavFileWriter&) = delete;
+
+		const WavFormat& getFormat() const {
+			return encoder.getFormat();
+		}
+
+		void writeHeader();
+		// interleaved frames, see WavFileWriter::writeSamples
+		void writeSamples(const float* samples, size_t frames);
+		// one block per channel
+		void writeFrames(const float* const* channels, size_t frames);
+		// waits for the writer thread to finish and fills in the header
+		void close();
+
+		Stats stats() const;
+
+		// one source per channel, see WavFileWriter::render
+		template<class... T>
+		void render(SoundSource<T>&... sources) {
+			renderChannels(getFormat().channels, longestOf(sources...), 16 * BLOCK_SIZE, [&](Time, const float* const* channels, int frames) {
+				writeFrames(channels, frames);
+				return true;
+			}, sources...);
+		}
+	};
+
+};
+
+#endif
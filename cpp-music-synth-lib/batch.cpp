@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fileformats.h"
+#include "patch.h"
+#include "threadpool.h"
+
+/*
+	BATCH RENDERER
+	renders many patches to wav files in one process.
+
+	usage: batch <manifest> [-j threads]
+
+	the manifest has one job per line, # starts a comment:
+		# patch              output            [seconds]
+		patches/kick.txt     out/kick.wav
+		patches/pad.txt      out/pad.wav       2.5
+
+	without a length the job renders until the patch ends, a patch that never
+	ends needs one. with a length the file is exactly that long, silence
+	after the patch ends. every patch file is parsed and compiled once however many
+	jobs use it. each worker thread keeps its program registers, block buffer
+	and file writer from one job to the next, so a job costs its rendering and
+	its file, not a new process and a fresh set of allocations.
+
+	prints one line per job with its throughput and a summary at the end,
+	exits with 1 if any job failed.
+*/
+
+using namespace synth;
+
+struct Job {
+	std::string patch;
+	std::string output;
+	Time length; // FOREVER: until the patch ends
+	int line;
+};
+
+static std::vector<Job> readManifest(const char* fname) {
+	std::ifstream f(fname);
+	if (!f.is_open())
+		throw std::runtime_error(std::string("could not open manifest ") + fname);
+
+	std::vector<Job> jobs;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(f, line)) {
+		++lineNumber;
+		std::stringstream words(line.substr(0, line.find('#')));
+		Job job;
+		job.line = lineNumber;
+		job.length = FOREVER;
+		if (!(words >> job.patch))
+			continue;
+		if (!(words >> job.output))
+			throw std::runtime_error("manifest line " + std::to_string(lineNumber) + ": expected '<patch> <output> [seconds]'");
+		float length;
+		if (words >> length)
+			job.length = seconds(length);
+		else if (!words.eof())
+			throw std::runtime_error("manifest line " + std::to_string(lineNumber) + ": expected a length in seconds");
+		jobs.push_back(job);
+	}
+	return jobs;
+}
+
+// every patch is compiled once, the workers copy the shared program
+class PatchCache {
+private:
+	std::map<std::string, std::shared_ptr<const PatchProgram>> programs;
+	std::mutex lock;
+
+public:
+	std::shared_ptr<const PatchProgram> get(const std::string& fname) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = programs.find(fname);
+			if (found != programs.end())
+				return found->second;
+		}
+		// compiled outside the lock, if two workers race for the same patch the first one wins
+		auto program = std::make_shared<const PatchProgram>(PatchProgram::compile(PatchGraph::load(fname.c_str())));
+		std::lock_guard<std::mutex> guard(lock);
+		return programs.emplace(fname, program).first->second;
+	}
+};
+
+struct Totals {
+	std::atomic<int> done;
+	std::atomic<int> failed;
+	std::atomic<long long> frames;
+	std::mutex print;
+
+	Totals() : done(0), failed(0), frames(0) { };
+};
+
+// the state a worker keeps warm between jobs
+class Worker {
+private:
+	static const int RENDER_FRAMES = 16 * BLOCK_SIZE;
+
+	PatchProgram program;
+	std::vector<float> block;
+	std::unique_ptr<WavFileWriter> writer;
+
+public:
+	Worker() : block(RENDER_FRAMES) { };
+
+	Time render(const Job& job, const PatchProgram& compiled) {
+		program = compiled;
+		Time end = program.activeRange().end();
+		Time length = job.length == FOREVER ? end : job.length;
+		if (length == FOREVER)
+			throw std::runtime_error("the patch never ends, give the job a length");
+
+		if (writer)
+			writer->open(job.output.c_str());
+		else
+			writer.reset(new WavFileWriter(job.output.c_str()));
+
+		writer->writeHeader();
+		for (Time time = 0; time < length; time += RENDER_FRAMES) {
+			int frames = std::min<Time>(RENDER_FRAMES, length - time);
+			// past the end of the patch the job is padded with silence
+			if (time < end)
+				program.render(time, block.data(), frames);
+			else
+				std::fill(block.begin(), block.begin() + frames, 0.0f);
+			writer->writeSamples(block.data(), frames);
+		}
+		writer->close();
+		return length;
+	}
+};
+
+int main(int argc, char** argv) {
+	const char* manifest = nullptr;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = std::max(1, atoi(argv[++i]));
+		else if (manifest == nullptr)
+			manifest = argv[i];
+		else
+			manifest = "";
+	}
+	if (manifest == nullptr || !*manifest) {
+		fprintf(stderr, "usage: %s <manifest> [-j threads]\n", argv[0]);
+		return 2;
+	}
+
+	std::vector<Job> jobs;
+	try {
+		jobs = readManifest(manifest);
+	} catch (const std::runtime_error& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	auto started = Clock::now();
+	PatchCache patches;
+	Totals totals;
+	std::atomic<size_t> next(0);
+	threads = std::min<int>(threads, std::max<size_t>(jobs.size(), 1));
+
+	{
+		// one long running task per thread, each with its own worker state, pulling jobs in manifest order
+		ThreadPool pool(threads);
+		for (int t = 0; t < threads; ++t) {
+			pool.submit([&] {
+				Worker worker;
+				for (size_t i = next++; i < jobs.size(); i = next++) {
+					const Job& job = jobs[i];
+					auto jobStarted = Clock::now();
+					try {
+						Time frames = worker.render(job, *patches.get(job.patch));
+						double elapsed = std::chrono::duration<double>(Clock::now() - jobStarted).count();
+						double audio = (double) frames / SAMPLES_PER_SECOND;
+						totals.frames += frames;
+						std::lock_guard<std::mutex> guard(totals.print);
+						printf("%s -> %s: %.2fs of audio in %.1fms, %.0fx realtime, %.1f Mframes/s\n",
+							job.patch.c_str(), job.output.c_str(), audio, elapsed * 1000,
+							audio / elapsed, frames / elapsed / 1e6);
+					} catch (const std::runtime_error& e) {
+						++totals.failed;
+						std::lock_guard<std::mutex> guard(totals.print);
+						printf("%s -> %s: failed (manifest line %d): %s\n", job.patch.c_str(), job.output.c_str(), job.line, e.what());
+					}
+					++totals.done;
+				}
+			});
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+	double audio = (double) totals.frames / SAMPLES_PER_SECOND;
+	printf("%d jobs (%d failed) on %d threads: %.1fs of audio in %.2fs, %.0fx realtime, %.1f jobs/s\n",
+		(int) totals.done, (int) totals.failed, threads, audio, elapsed, audio / elapsed, totals.done / elapsed);
+	return totals.failed ? 1 : 0;
+}
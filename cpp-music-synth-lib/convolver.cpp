@@ -0,0 +1,161 @@
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "convolver.h"
+#include "fileformats.h"
+
+namespace synth {
+
+	/*
+		impulse responses
+	*/
+	static bool powerOfTwo(int value) {
+		return value > 0 && (value & (value - 1)) == 0;
+	}
+
+	ImpulseResponse::ImpulseResponse(const std::vector<float>& samples, int latency, int tailSize)
+		: latency(latency), length(samples.size()), gain(0) {
+		if (!powerOfTwo(latency) || latency < 2)
+			throw std::runtime_error("the latency of a convolution must be a power of two of at least 2, not " + std::to_string(latency));
+		if (!powerOfTwo(tailSize) || tailSize < latency)
+			throw std::runtime_error("the tail partitions of a convolution must be a power of two no shorter than its latency, not " + std::to_string(tailSize));
+
+		for (float sample : samples)
+			gain += std::fabs(sample);
+
+		auto addSegment = [&](int size, int offset, int end) {
+			if (end <= offset)
+				return;
+			Segment segment;
+			segment.size = size;
+			segment.offset = offset;
+			segment.partitions = (end - offset + size - 1) / size;
+			segment.fft = RealFFT::get(2 * size);
+			const int bins = segment.fft->bins();
+			segment.re.resize((size_t) segment.partitions * bins);
+			segment.im.resize((size_t) segment.partitions * bins);
+			std::vector<float> padded(2 * size);
+			for (int p = 0; p < segment.partitions; ++p) {
+				int first = offset + p * size;
+				int count = std::min(size, end - first);
+				std::fill(padded.begin(), padded.end(), 0.0f);
+				std::copy(samples.begin() + first, samples.begin() + first + count, padded.begin());
+				segment.fft->forward(padded.data(), segment.re.data() + (size_t) p * bins, segment.im.data() + (size_t) p * bins);
+			}
+			segments.push_back(std::move(segment));
+		};
+		addSegment(latency, 0, std::min(length, tailSize));
+		addSegment(tailSize, tailSize, length);
+	}
+
+	std::shared_ptr<const ImpulseResponse> ImpulseResponse::load(const char* fname, int latency, int tailSize, int channel) {
+		WavFileReader reader(fname);
+		if (channel >= reader.getChannels())
+			throw std::runtime_error("the file has no channel " + std::to_string(channel));
+		std::vector<float> samples(std::min<size_t>(reader.getFrames(), FOREVER / 2));
+		reader.read(0, samples.data(), samples.size(), channel);
+		return std::make_shared<const ImpulseResponse>(samples, latency, tailSize);
+	}
+
+	/*
+		running a convolution
+		a segment of partitions of size samples is fed latency samples at a time.
+		once size samples are in they are transformed, become the newest entry of
+		the delay line and the sums are transformed back: the first half plus the
+		overlap of the previous block is the next output block, the second half
+		the new overlap. for the head (offset 0, size = latency) that block is the
+		output of the samples just fed. for the tail (offset = size) it is the
+		output of the next size samples, the response starts size samples late.
+
+		partition j meets the input spectrum j blocks old. those with j >= 1 are
+		known a whole block ahead, so they are summed a slice at a time while the
+		block is being collected.
+	*/
+	Convolution::Convolution(std::shared_ptr<const ImpulseResponse> response) : response(response) {
+		if (!response)
+			return;
+		for (const ImpulseResponse::Segment& segment : response->segments) {
+			SegmentState state;
+			const size_t bins = segment.fft->bins();
+			state.input.resize(2 * segment.size);
+			state.re.resize(segment.partitions * bins);
+			state.im.resize(segment.partitions * bins);
+			state.sumRe.resize(bins);
+			state.sumIm.resize(bins);
+			state.samples.resize(2 * segment.size);
+			state.overlap.resize(segment.size);
+			state.output.resize(segment.size);
+			states.push_back(std::move(state));
+		}
+		reset();
+	}
+
+	void Convolution::reset() {
+		for (SegmentState& state : states) {
+			std::fill(state.input.begin(), state.input.end(), 0.0f);
+			std::fill(state.re.begin(), state.re.end(), 0.0f);
+			std::fill(state.im.begin(), state.im.end(), 0.0f);
+			std::fill(state.sumRe.begin(), state.sumRe.end(), 0.0f);
+			std::fill(state.sumIm.begin(), state.sumIm.end(), 0.0f);
+			std::fill(state.overlap.begin(), state.overlap.end(), 0.0f);
+			std::fill(state.output.begin(), state.output.end(), 0.0f);
+			state.newest = 0;
+			state.position = 0;
+		}
+	}
+
+	void Convolution::step(const ImpulseResponse::Segment& segment, SegmentState& state, const float* in, float* out) {
+		const int latency = response->latency;
+		const int size = segment.size;
+		const int partitions = segment.partitions;
+		const int bins = segment.fft->bins();
+		const bool immediate = segment.offset == 0;
+
+		if (!immediate) {
+			for (int i = 0; i < latency; ++i)
+				out[i] += state.output[state.position + i];
+		}
+
+		// this step's slice of the partitions 1 .. partitions - 1
+		const int steps = size / latency;
+		const int slice = state.position / latency;
+		const int first = 1 + (long long) (partitions - 1) * slice / steps;
+		const int last = 1 + (long long) (partitions - 1) * (slice + 1) / steps;
+		for (int j = first; j < last; ++j) {
+			int entry = (state.newest - (j - 1) + partitions) % partitions;
+			dsp::complexMulAdd(state.sumRe.data(), state.sumIm.data(),
+				segment.re.data() + (size_t) j * bins, segment.im.data() + (size_t) j * bins,
+				state.re.data() + (size_t) entry * bins, state.im.data() + (size_t) entry * bins, bins);
+		}
+
+		std::copy(in, in + latency, state.input.begin() + state.position);
+		state.position += latency;
+		if (state.position == size) {
+			state.position = 0;
+			state.newest = (state.newest + 1) % partitions;
+			float* re = state.re.data() + (size_t) state.newest * bins;
+			float* im = state.im.data() + (size_t) state.newest * bins;
+			segment.fft->forward(state.input.data(), re, im);
+			dsp::complexMulAdd(state.sumRe.data(), state.sumIm.data(), segment.re.data(), segment.im.data(), re, im, bins);
+
+			segment.fft->inverse(state.sumRe.data(), state.sumIm.data(), state.samples.data());
+			std::fill(state.sumRe.begin(), state.sumRe.end(), 0.0f);
+			std::fill(state.sumIm.begin(), state.sumIm.end(), 0.0f);
+			for (int i = 0; i < size; ++i) {
+				state.output[i] = state.samples[i] + state.overlap[i];
+				state.overlap[i] = state.samples[size + i];
+			}
+		}
+
+		if (immediate) {
+			for (int i = 0; i < latency; ++i)
+				out[i] += state.output[i];
+		}
+	}
+
+	void Convolution::process(const float* in, float* out) {
+		for (size_t s = 0; s < states.size(); ++s)
+			step(response->segments[s], states[s], in, out);
+	}
+
+};
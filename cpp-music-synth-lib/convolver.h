@@ -0,0 +1,224 @@
+#ifndef __CONVOLVER_H_
+#define __CONVOLVER_H_
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "synth2.h"
+#include "realfft.h"
+
+namespace synth {
+
+	/*
+		PARTITIONED CONVOLUTION
+		convolving with an impulse response of length M directly costs M
+		multiplies per sample. here the response is cut into partitions, every
+		partition is transformed once up front, and each block of input is
+		transformed once and multiplied with every partition in the frequency
+		domain (uniformly partitioned overlap-add). the spectra of past input
+		blocks are kept in a delay line so each one meets every partition.
+
+		the response is split into two segments:
+		 - the head, the first tailSize samples in partitions of latency samples.
+		   input and output move in blocks of latency samples, a smaller latency
+		   means more partitions in the head but less work per block.
+		 - the tail, everything after that in partitions of tailSize samples.
+		   tail output for the next tailSize samples is due at the end of each
+		   input block of tailSize samples, the products with the older input
+		   spectra are spread evenly over the blocks before it. only the products
+		   with the newest block and the two transforms of the tail are left for
+		   that block, so a response of several seconds adds little to the cost
+		   of each latency block.
+		latency and tailSize are powers of two, tailSize at least latency.
+	*/
+	class ImpulseResponse {
+	public:
+		struct Segment {
+			int size;       // samples per partition, the transforms are twice as long
+			int offset;     // the first sample of the response in the segment, 0 or size
+			int partitions;
+			std::shared_ptr<const RealFFT> fft;
+			std::vector<float> re, im; // the bins of every partition, one after the other
+		};
+
+		int latency;
+		Time length;
+		float gain; // the sum of the absolute samples, what one full scale input can add up to
+		std::vector<Segment> segments;
+
+		ImpulseResponse(const std::vector<float>& samples, int latency, int tailSize);
+
+		// the response in a wav file, channel -1 mixes all channels down. like SampleSource
+		// the file is used sample for sample, files at other sample rates are not resampled
+		static std::shared_ptr<const ImpulseResponse> load(const char* fname, int latency = BLOCK_SIZE,
+			int tailSize = 4096, int channel = -1);
+	};
+
+	/*
+		the running state of one convolution: the input spectra of every segment,
+		the partly summed products of the tail and the overlap of the last block.
+		usage: Convolution c(response); c.process(in, out); // response->latency samples each
+	*/
+	class Convolution {
+	private:
+		struct SegmentState {
+			std::vector<float> input;      // the block being collected, zero padded to the transform size
+			std::vector<float> re, im;     // the delay line of input spectra
+			std::vector<float> sumRe, sumIm; // the products summed so far for the next output block
+			std::vector<float> samples;    // the inverse transform of the sums
+			std::vector<float> overlap;    // its second half, added to the following block
+			std::vector<float> output;     // the output block being played
+			int newest;   // the delay line entry of the latest input spectrum
+			int position; // samples of the current block collected so far
+		};
+
+		std::shared_ptr<const ImpulseResponse> response;
+		std::vector<SegmentState> states;
+
+		void step(const ImpulseResponse::Segment& segment, SegmentState& state, const float* in, float* out);
+
+	public:
+		Convolution() { };
+		explicit Convolution(std::shared_ptr<const ImpulseResponse> response);
+
+		// back to silence, as if no input had been seen yet
+		void reset();
+
+		// takes the next response->latency input samples and adds the matching output samples to out
+		void process(const float* in, float* out);
+	};
+
+	// an effect convolving a source with an impulse response, for cabinets, rooms and reverbs.
+	// the output is not delayed: a block of latency samples of the source is rendered as soon
+	// as the first sample of it is needed, so the source runs up to latency - 1 samples ahead.
+	// blocks start at multiples of latency, with the default latency of BLOCK_SIZE a block walk
+	// of the tree never reads ahead. a jump in time starts over, rendering the stretch of the
+	// source the response still hears first.
+	// usage: convolverOf(wave, "hall.wav") or Convolver<T>(wave, ImpulseResponse::load("hall.wav", 64, 8192))
+	template<class DerivedClass>
+	struct Convolver : public SoundSource<Convolver<DerivedClass>> {
+		DerivedClass wave;
+		std::shared_ptr<const ImpulseResponse> response;
+		Convolution convolution;
+		std::vector<float> input;
+		std::vector<float> block; // output of the block starting at blockStart
+		Time blockStart;
+		bool primed; // block holds output
+
+		Convolver() : blockStart(0), primed(false) {
+			static_assert(std::is_base_of<SoundSource<DerivedClass>, DerivedClass>::value, "Convolver expects to be provided with a SoundSource.");
+		};
+
+		Convolver(const DerivedClass& wave, std::shared_ptr<const ImpulseResponse> response)
+			: wave(wave), response(response), convolution(response), blockStart(0), primed(false) {
+			input.resize(response->latency);
+			block.resize(response->latency);
+		}
+
+		Convolver(const DerivedClass& wave, const char* fname, int latency = BLOCK_SIZE, int tailSize = 4096)
+			: Convolver(wave, ImpulseResponse::load(fname, latency, tailSize)) {
+		}
+
+		bool _stateless() const {
+			return false;
+		}
+
+		// a bound, far above the real peak for long responses
+		float _maxAmp() const {
+			return response ? wave.maxAmp() * response->gain : 0;
+		}
+
+		TimeRange _activeRange() const {
+			TimeRange range = wave.activeRange();
+			if (!response || range.empty() || response->length == 0)
+				return TimeRange::never();
+			Time end = range.end();
+			return TimeRange::between(range.offset, end >= FOREVER - response->length ? FOREVER : end + response->length - 1);
+		}
+
+		float _sample(const Context& context) {
+			float value;
+			_render(context, &value, 1);
+			return value;
+		}
+
+		void _render(const Context& context, float* out, int frames) {
+			if (!response) {
+				std::fill(out, out + frames, 0.0f);
+				return;
+			}
+			const int latency = response->latency;
+			for (int done = 0; done < frames; ) {
+				Time time = context.time + done;
+				Time start = time - ((time % latency) + latency) % latency;
+				if (!primed || start != blockStart)
+					seek(context, start);
+				int from = time - start;
+				int n = std::min(latency - from, frames - done);
+				std::copy(block.begin() + from, block.begin() + from + n, out + done);
+				done += n;
+			}
+		}
+
+		std::string _toString() const {
+			std::stringstream ss;
+			ss << "Convolver(" << wave.toString() << ", " << (response ? response->length : 0) << ")";
+			return ss.str();
+		}
+
+		void inherit(const Convolver<DerivedClass>& parent) {
+			wave = parent.wave;
+			response = parent.response;
+			convolution = Convolution(response);
+			input = parent.input;
+			block = parent.block;
+			primed = false;
+		}
+
+	private:
+		// convolves the block of the source starting at start
+		void next(const Context& context, Time start) {
+			const int latency = response->latency;
+			Context c(context);
+			c.time = start;
+			if (wave.activeRange().overlaps(start, latency))
+				wave.render(c, input.data(), latency);
+			else
+				std::fill(input.begin(), input.end(), 0.0f);
+			std::fill(block.begin(), block.end(), 0.0f);
+			convolution.process(input.data(), block.data());
+			blockStart = start;
+			primed = true;
+		}
+
+		// makes block the output of the block starting at start
+		void seek(const Context& context, Time start) {
+			const int latency = response->latency;
+			if (!primed || start != blockStart + latency) {
+				convolution.reset();
+				// the source before start is still heard for length samples
+				TimeRange range = wave.activeRange();
+				Time from = start - (response->length + latency - 1) / latency * latency;
+				if (range.offset > from)
+					from = range.offset - ((range.offset % latency) + latency) % latency;
+				for (Time t = from; t < start; t += latency)
+					next(context, t);
+			}
+			next(context, start);
+		}
+	};
+
+	template<class T>
+	Convolver<T> convolverOf(const SoundSource<T>& wave, const char* fname, int latency = BLOCK_SIZE, int tailSize = 4096) {
+		return Convolver<T>(wave.get_ref(), fname, latency, tailSize);
+	}
+
+	template<class T>
+	Convolver<T> convolverOf(const SoundSource<T>& wave, std::shared_ptr<const ImpulseResponse> response) {
+		return Convolver<T>(wave.get_ref(), response);
+	}
+
+};
+
+#endif
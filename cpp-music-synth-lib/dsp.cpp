@@ -0,0 +1,477 @@
+#include <cmath>
+#include "dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SYNTH_DSP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace synth {
+namespace dsp {
+
+	/*
+		sine approximation
+		x is reduced to [-0.5, 0.5] cycles, folded onto [-0.25, 0.25] using
+		sin(pi - a) = sin(a), then fed through the taylor series of sin(2 pi y)
+		up to y^11. the truncation error at a quarter cycle is below 6e-8, the
+		rest of the error budget is float rounding.
+	*/
+	const float SIN_C1 = 6.283185307179586f;
+	const float SIN_C3 = -41.341702240399755f;
+	const float SIN_C5 = 81.60524927607504f;
+	const float SIN_C7 = -76.70585975306136f;
+	const float SIN_C9 = 42.058693944897634f;
+	const float SIN_C11 = -15.094642576822984f;
+
+	static inline float sinCycles(float x) {
+		x -= std::nearbyint(x);
+		float a = std::fabs(x);
+		float y = std::copysign(std::fmin(a, 0.5f - a), x);
+		float z = y * y;
+		float p = SIN_C11;
+		p = p * z + SIN_C9;
+		p = p * z + SIN_C7;
+		p = p * z + SIN_C5;
+		p = p * z + SIN_C3;
+		p = p * z + SIN_C1;
+		return p * y;
+	}
+
+	// the phase at the start of each vector is recomputed in double and wrapped to [0, 1),
+	// the vector versions add the offsets of their lanes to it in double as well.
+	static inline double wrappedPhaseDouble(double phase, double increment, int i) {
+		double p = phase + i * increment;
+		return p - std::floor(p);
+	}
+
+	static inline float wrappedPhase(double phase, double increment, int i) {
+		return (float) wrappedPhaseDouble(phase, increment, i);
+	}
+
+	static void sinBlockScalar(float* out, int frames, double phase, double increment) {
+		for (int i = 0; i < frames; ++i)
+			out[i] = sinCycles(wrappedPhase(phase, increment, i));
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void sinBlockSSE2(float* out, int frames, double phase, double increment) {
+		const __m128d lanesLow = _mm_set_pd(increment, 0);
+		const __m128d lanesHigh = _mm_set_pd(3 * increment, 2 * increment);
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		int i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			// every lane is wrapped in double, so the float phase only carries the rounding of the final conversion
+			__m128d base = _mm_set1_pd(wrappedPhaseDouble(phase, increment, i));
+			__m128d low = _mm_add_pd(base, lanesLow);
+			__m128d high = _mm_add_pd(base, lanesHigh);
+			low = _mm_sub_pd(low, _mm_cvtepi32_pd(_mm_cvtpd_epi32(low)));
+			high = _mm_sub_pd(high, _mm_cvtepi32_pd(_mm_cvtpd_epi32(high)));
+			__m128 x = _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+
+			__m128 sign = _mm_and_ps(x, signMask);
+			__m128 a = _mm_andnot_ps(signMask, x);
+			__m128 y = _mm_or_ps(_mm_min_ps(a, _mm_sub_ps(half, a)), sign);
+			__m128 z = _mm_mul_ps(y, y);
+
+			__m128 p = _mm_set1_ps(SIN_C11);
+			p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(SIN_C9));
+			p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(SIN_C7));
+			p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(SIN_C5));
+			p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(SIN_C3));
+			p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(SIN_C1));
+			_mm_storeu_ps(out + i, _mm_mul_ps(p, y));
+		}
+		for (; i < frames; ++i)
+			out[i] = sinCycles(wrappedPhase(phase, increment, i));
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void sinBlockAVX2(float* out, int frames, double phase, double increment) {
+		const __m256d lanesLow = _mm256_set_pd(3 * increment, 2 * increment, increment, 0);
+		const __m256d lanesHigh = _mm256_set_pd(7 * increment, 6 * increment, 5 * increment, 4 * increment);
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+
+		int i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			__m256d base = _mm256_set1_pd(wrappedPhaseDouble(phase, increment, i));
+			__m256d low = _mm256_add_pd(base, lanesLow);
+			__m256d high = _mm256_add_pd(base, lanesHigh);
+			low = _mm256_sub_pd(low, _mm256_round_pd(low, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+			high = _mm256_sub_pd(high, _mm256_round_pd(high, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+			__m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+
+			__m256 sign = _mm256_and_ps(x, signMask);
+			__m256 a = _mm256_andnot_ps(signMask, x);
+			__m256 y = _mm256_or_ps(_mm256_min_ps(a, _mm256_sub_ps(half, a)), sign);
+			__m256 z = _mm256_mul_ps(y, y);
+
+			__m256 p = _mm256_set1_ps(SIN_C11);
+			p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(SIN_C9));
+			p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(SIN_C7));
+			p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(SIN_C5));
+			p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(SIN_C3));
+			p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(SIN_C1));
+			_mm256_storeu_ps(out + i, _mm256_mul_ps(p, y));
+		}
+		for (; i < frames; ++i)
+			out[i] = sinCycles(wrappedPhase(phase, increment, i));
+	}
+#endif
+
+	/*
+		multiply
+	*/
+	static void mulBlockScalar(float* out, const float* by, int frames) {
+		for (int i = 0; i < frames; ++i)
+			out[i] *= by[i];
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void mulBlockSSE2(float* out, const float* by, int frames) {
+		int i = 0;
+		for (; i + 4 <= frames; i += 4)
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(by + i)));
+		for (; i < frames; ++i)
+			out[i] *= by[i];
+	}
+
+	__attribute__((target("avx2")))
+	static void mulBlockAVX2(float* out, const float* by, int frames) {
+		int i = 0;
+		for (; i + 8 <= frames; i += 8)
+			_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(out + i), _mm256_loadu_ps(by + i)));
+		for (; i < frames; ++i)
+			out[i] *= by[i];
+	}
+#endif
+
+	/*
+		pcm conversion
+		clamping happens in float before the conversion so out of range input can
+		not overflow the integer conversion.
+	*/
+	static void toPcm16Scalar(const float* in, int16_t* out, int frames, float scale, int limit) {
+		for (int i = 0; i < frames; ++i) {
+			float value = std::fmin(std::fmax(in[i] * scale, (float) -limit), (float) limit);
+			out[i] = (int16_t) std::lrint(value);
+		}
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void toPcm16SSE2(const float* in, int16_t* out, int frames, float scale, int limit) {
+		const __m128 s = _mm_set1_ps(scale);
+		const __m128 hi = _mm_set1_ps((float) limit);
+		const __m128 lo = _mm_set1_ps((float) -limit);
+		int i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), lo), hi);
+			__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), s), lo), hi);
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+			_mm_storeu_si128((__m128i*) (out + i), packed);
+		}
+		toPcm16Scalar(in + i, out + i, frames - i, scale, limit);
+	}
+
+	__attribute__((target("avx2")))
+	static void toPcm16AVX2(const float* in, int16_t* out, int frames, float scale, int limit) {
+		const __m256 s = _mm256_set1_ps(scale);
+		const __m256 hi = _mm256_set1_ps((float) limit);
+		const __m256 lo = _mm256_set1_ps((float) -limit);
+		int i = 0;
+		for (; i + 16 <= frames; i += 16) {
+			__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), s), lo), hi);
+			__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), s), lo), hi);
+			// packs works within 128 bit lanes, the permute puts the four quarters back in order
+			__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+			packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i*) (out + i), packed);
+		}
+		toPcm16Scalar(in + i, out + i, frames - i, scale, limit);
+	}
+#endif
+
+	/*
+		24 bit pcm
+		the vector versions convert to 32 bit integers the same way as toPcm16
+		and then drop the top byte of every lane.
+	*/
+	static void toPcm24Scalar(const float* in, uint8_t* out, int frames, float scale, int limit) {
+		for (int i = 0; i < frames; ++i) {
+			float value = std::fmin(std::fmax(in[i] * scale, (float) -limit), (float) limit);
+			int32_t pcm = (int32_t) std::lrint(value);
+			out[3 * i] = (uint8_t) pcm;
+			out[3 * i + 1] = (uint8_t) (pcm >> 8);
+			out[3 * i + 2] = (uint8_t) (pcm >> 16);
+		}
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void toPcm24SSE2(const float* in, uint8_t* out, int frames, float scale, int limit) {
+		const __m128 s = _mm_set1_ps(scale);
+		const __m128 hi = _mm_set1_ps((float) limit);
+		const __m128 lo = _mm_set1_ps((float) -limit);
+		alignas(16) int32_t pcm[4];
+		int i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), lo), hi);
+			_mm_store_si128((__m128i*) pcm, _mm_cvtps_epi32(a));
+			uint8_t* at = out + 3 * i;
+			for (int k = 0; k < 4; ++k, at += 3) {
+				at[0] = (uint8_t) pcm[k];
+				at[1] = (uint8_t) (pcm[k] >> 8);
+				at[2] = (uint8_t) (pcm[k] >> 16);
+			}
+		}
+		toPcm24Scalar(in + i, out + 3 * i, frames - i, scale, limit);
+	}
+
+	__attribute__((target("avx2")))
+	static void toPcm24AVX2(const float* in, uint8_t* out, int frames, float scale, int limit) {
+		const __m256 s = _mm256_set1_ps(scale);
+		const __m256 hi = _mm256_set1_ps((float) limit);
+		const __m256 lo = _mm256_set1_ps((float) -limit);
+		// packs the low 3 bytes of each 32 bit value into the first 12 bytes of its 128 bit lane
+		const __m256i pack = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		int i = 0;
+		// each step stores 16 bytes at 12 bytes past its start, so stop while that still fits
+		for (; i + 10 <= frames; i += 8) {
+			__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), s), lo), hi);
+			__m256i packed = _mm256_shuffle_epi8(_mm256_cvtps_epi32(a), pack);
+			_mm_storeu_si128((__m128i*) (out + 3 * i), _mm256_castsi256_si128(packed));
+			_mm_storeu_si128((__m128i*) (out + 3 * i + 12), _mm256_extracti128_si256(packed, 1));
+		}
+		toPcm24Scalar(in + i, out + 3 * i, frames - i, scale, limit);
+	}
+#endif
+
+	/*
+		interleaving
+	*/
+	static void interleaveScalar(const float* const* in, int channels, float* out, int frames) {
+		for (int c = 0; c < channels; ++c) {
+			const float* from = in[c];
+			for (int i = 0; i < frames; ++i)
+				out[i * channels + c] = from[i];
+		}
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void interleaveSSE2(const float* const* in, int channels, float* out, int frames) {
+		int i = 0;
+		if (channels == 2) {
+			for (; i + 4 <= frames; i += 4) {
+				__m128 l = _mm_loadu_ps(in[0] + i);
+				__m128 r = _mm_loadu_ps(in[1] + i);
+				_mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+				_mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+			}
+		} else if (channels == 4) {
+			for (; i + 4 <= frames; i += 4) {
+				__m128 a = _mm_loadu_ps(in[0] + i);
+				__m128 b = _mm_loadu_ps(in[1] + i);
+				__m128 c = _mm_loadu_ps(in[2] + i);
+				__m128 d = _mm_loadu_ps(in[3] + i);
+				_MM_TRANSPOSE4_PS(a, b, c, d);
+				_mm_storeu_ps(out + 4 * i, a);
+				_mm_storeu_ps(out + 4 * i + 4, b);
+				_mm_storeu_ps(out + 4 * i + 8, c);
+				_mm_storeu_ps(out + 4 * i + 12, d);
+			}
+		}
+		for (; i < frames; ++i)
+			for (int c = 0; c < channels; ++c)
+				out[i * channels + c] = in[c][i];
+	}
+
+	__attribute__((target("avx2")))
+	static void interleaveAVX2(const float* const* in, int channels, float* out, int frames) {
+		if (channels != 2) {
+			interleaveSSE2(in, channels, out, frames);
+			return;
+		}
+		int i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			__m256 l = _mm256_loadu_ps(in[0] + i);
+			__m256 r = _mm256_loadu_ps(in[1] + i);
+			// unpack works within 128 bit lanes, frames 0-1 and 4-5 end up in lo, 2-3 and 6-7 in hi
+			__m256 lo = _mm256_unpacklo_ps(l, r);
+			__m256 hi = _mm256_unpackhi_ps(l, r);
+			_mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+			_mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+		}
+		for (; i < frames; ++i) {
+			out[2 * i] = in[0][i];
+			out[2 * i + 1] = in[1][i];
+		}
+	}
+#endif
+
+	/*
+		complex multiply accumulate
+		on split arrays, real and imaginary parts apart, so every lane holds
+		one bin and no shuffles are needed.
+	*/
+	static void complexMulAddScalar(float* accRe, float* accIm, const float* aRe, const float* aIm,
+		const float* bRe, const float* bIm, int count) {
+		for (int i = 0; i < count; ++i) {
+			accRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+			accIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+		}
+	}
+
+#ifdef SYNTH_DSP_X86
+	__attribute__((target("sse2")))
+	static void complexMulAddSSE2(float* accRe, float* accIm, const float* aRe, const float* aIm,
+		const float* bRe, const float* bIm, int count) {
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 ar = _mm_loadu_ps(aRe + i), ai = _mm_loadu_ps(aIm + i);
+			__m128 br = _mm_loadu_ps(bRe + i), bi = _mm_loadu_ps(bIm + i);
+			__m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+			__m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+			_mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+			_mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+		}
+		complexMulAddScalar(accRe + i, accIm + i, aRe + i, aIm + i, bRe + i, bIm + i, count - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void complexMulAddAVX2(float* accRe, float* accIm, const float* aRe, const float* aIm,
+		const float* bRe, const float* bIm, int count) {
+		int i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 ar = _mm256_loadu_ps(aRe + i), ai = _mm256_loadu_ps(aIm + i);
+			__m256 br = _mm256_loadu_ps(bRe + i), bi = _mm256_loadu_ps(bIm + i);
+			__m256 re = _mm256_fmadd_ps(ar, br, _mm256_loadu_ps(accRe + i));
+			__m256 im = _mm256_fmadd_ps(ar, bi, _mm256_loadu_ps(accIm + i));
+			_mm256_storeu_ps(accRe + i, _mm256_fnmadd_ps(ai, bi, re));
+			_mm256_storeu_ps(accIm + i, _mm256_fmadd_ps(ai, br, im));
+		}
+		complexMulAddScalar(accRe + i, accIm + i, aRe + i, aIm + i, bRe + i, bIm + i, count - i);
+	}
+#endif
+
+	/*
+		runtime dispatch
+	*/
+	typedef void (*SinBlockFn)(float*, int, double, double);
+
+	static SinBlockFn pickSinBlock() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return sinBlockAVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return sinBlockSSE2;
+#endif
+		return sinBlockScalar;
+	}
+
+	void sinBlock(float* out, int frames, double phase, double increment) {
+		static const SinBlockFn impl = pickSinBlock();
+		impl(out, frames, phase, increment);
+	}
+
+	typedef void (*MulBlockFn)(float*, const float*, int);
+
+	static MulBlockFn pickMulBlock() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return mulBlockAVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return mulBlockSSE2;
+#endif
+		return mulBlockScalar;
+	}
+
+	void mulBlock(float* out, const float* by, int frames) {
+		static const MulBlockFn impl = pickMulBlock();
+		impl(out, by, frames);
+	}
+
+	typedef void (*ToPcm16Fn)(const float*, int16_t*, int, float, int);
+
+	static ToPcm16Fn pickToPcm16() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return toPcm16AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return toPcm16SSE2;
+#endif
+		return toPcm16Scalar;
+	}
+
+	void toPcm16(const float* in, int16_t* out, int frames, float scale, int limit) {
+		static const ToPcm16Fn impl = pickToPcm16();
+		impl(in, out, frames, scale, limit);
+	}
+
+	typedef void (*ToPcm24Fn)(const float*, uint8_t*, int, float, int);
+
+	static ToPcm24Fn pickToPcm24() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return toPcm24AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return toPcm24SSE2;
+#endif
+		return toPcm24Scalar;
+	}
+
+	void toPcm24(const float* in, uint8_t* out, int frames, float scale, int limit) {
+		static const ToPcm24Fn impl = pickToPcm24();
+		impl(in, out, frames, scale, limit);
+	}
+
+	typedef void (*InterleaveFn)(const float* const*, int, float*, int);
+
+	static InterleaveFn pickInterleave() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return interleaveAVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return interleaveSSE2;
+#endif
+		return interleaveScalar;
+	}
+
+	void interleave(const float* const* in, int channels, float* out, int frames) {
+		static const InterleaveFn impl = pickInterleave();
+		impl(in, channels, out, frames);
+	}
+
+	typedef void (*ComplexMulAddFn)(float*, float*, const float*, const float*, const float*, const float*, int);
+
+	static ComplexMulAddFn pickComplexMulAdd() {
+#ifdef SYNTH_DSP_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return complexMulAddAVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return complexMulAddSSE2;
+#endif
+		return complexMulAddScalar;
+	}
+
+	void complexMulAdd(float* accRe, float* accIm, const float* aRe, const float* aIm,
+		const float* bRe, const float* bIm, int count) {
+		static const ComplexMulAddFn impl = pickComplexMulAdd();
+		impl(accRe, accIm, aRe, aIm, bRe, bIm, count);
+	}
+
+}
+}
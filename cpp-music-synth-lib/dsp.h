@@ -0,0 +1,59 @@
+#ifndef __DSP_H_
+#define __DSP_H_
+
+/*
+	BLOCK KERNELS
+	the inner loops used by the block rendering path. each kernel has a
+	scalar version plus SSE2 / AVX2 versions on x86, the best one available
+	on the running cpu is picked the first time the kernel is called.
+*/
+#include <stdint.h>
+
+namespace synth {
+namespace dsp {
+
+	/*
+		fills out[i] with sin(2 * pi * (phase + i * increment)) for i in [0, frames).
+		phase and increment are measured in cycles, so a wave with a period of
+		p samples has increment 1 / p. the phase of every sample is worked out
+		and wrapped to a single cycle in double precision, only the wrapped
+		phase goes to float.
+
+		the sine is an odd degree 11 polynomial over a quarter cycle.
+		maximum absolute error against sin() is 2.5e-7 for every version and
+		any period (measured 2.3e-7 down to periods of 2 samples).
+	*/
+	void sinBlock(float* out, int frames, double phase, double increment);
+
+	// out[i] *= by[i] for i in [0, frames)
+	void mulBlock(float* out, const float* by, int frames);
+
+	/*
+		converts floats to 16 bit pcm: out[i] = round(in[i] * scale), clamped to
+		[-limit, limit]. values are written in host byte order.
+	*/
+	void toPcm16(const float* in, int16_t* out, int frames, float scale, int limit);
+
+	/*
+		converts floats to packed little endian 24 bit pcm, 3 bytes per value:
+		round(in[i] * scale) clamped to [-limit, limit] goes to out[3 * i].
+	*/
+	void toPcm24(const float* in, uint8_t* out, int frames, float scale, int limit);
+
+	/*
+		interleaves planar blocks: out[i * channels + c] = in[c][i].
+		stereo and 4 channels have vector versions, other counts are scalar.
+	*/
+	void interleave(const float* const* in, int channels, float* out, int frames);
+
+	/*
+		acc += a * b for count complex values held as split arrays, the real
+		parts in one array and the imaginary parts in another.
+	*/
+	void complexMulAdd(float* accRe, float* accIm, const float* aRe, const float* aIm,
+		const float* bRe, const float* bIm, int count);
+
+}
+}
+
+#endif
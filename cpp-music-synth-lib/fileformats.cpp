@@ -1,67 +1,610 @@
 #include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "fileformats.h"
 #include <iostream>
 
 namespace synth {
 
+	/*
+		wav headers
+	*/
+	static void putBytes(char*& at, uint32_t value, unsigned size) {
+		for (; size; --size, value >>= 8)
+			*at++ = static_cast<char>(value & 0xFF);
+	}
+
+	static const int FORMAT_PCM = 1;
+	static const int FORMAT_FLOAT = 3;
+	static const int FORMAT_EXTENSIBLE = 0xFFFE;
+
+	static void putBytes64(char*& at, uint64_t value) {
+		putBytes(at, (uint32_t) value, 4);
+		putBytes(at, (uint32_t) (value >> 32), 4);
+	}
+
+	// W64 names its chunks with guids instead of four letters
+	static const unsigned char W64_RIFF[16] = { 'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 };
+	static const unsigned char W64_WAVE[16] = { 'w', 'a', 'v', 'e', 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+	static const unsigned char W64_FMT[16] = { 'f', 'm', 't', ' ', 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+	static const unsigned char W64_DATA[16] = { 'd', 'a', 't', 'a', 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+	static const int W64_CHUNK_HEADER = 24;
+
+	// the body of the fmt chunk, 16 bytes, 40 for WAVE_FORMAT_EXTENSIBLE
+	static void putFormat(char*& at, const WavFormat& format) {
+		int bitsPerSample = format.bitsPerSample();
+		int tag = format.encoding == WavFormat::FLOAT32 ? FORMAT_FLOAT : FORMAT_PCM;
+
+		putBytes(at, format.extensible() ? FORMAT_EXTENSIBLE : tag, 2); // AudioFormat: PCM = 1 linear quantization - indicates no compression
+		putBytes(at, format.channels, 2); // NumChannels:  1 = mono.
+		putBytes(at, format.sampleRate, 4); // sample rate.
+		putBytes(at, format.sampleRate * format.frameBytes(), 4); // ByteRate
+		putBytes(at, format.frameBytes(), 2); // BlockAlign
+		putBytes(at, bitsPerSample, 2); // BitsPerSample
+		if (format.extensible()) {
+			putBytes(at, 22, 2); // size of the extension
+			putBytes(at, bitsPerSample, 2); // valid bits
+			putBytes(at, format.channels < 32 ? (1u << format.channels) - 1 : 0xFFFFFFFFu, 4); // speaker mask
+			// the sub format guid, KSDATAFORMAT_SUBTYPE_PCM or _IEEE_FLOAT
+			static const unsigned char GUID_TAIL[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+			putBytes(at, tag, 2);
+			memcpy(at, GUID_TAIL, sizeof(GUID_TAIL)); at += sizeof(GUID_TAIL);
+		}
+	}
+
+	void encodeWavHeader(char* out, const WavFormat& format, uint64_t dataBytes) {
+		const bool unknown = dataBytes == WAV_UNKNOWN_SIZE;
+		const uint32_t fmtBytes = format.extensible() ? 40 : 16;
+		const uint64_t fileBytes = unknown ? WAV_UNKNOWN_SIZE : format.headerBytes() + dataBytes;
+		char* at = out;
+
+		if (format.container == WavFormat::W64) {
+			// the size of a W64 chunk counts its own header
+			memcpy(at, W64_RIFF, 16); at += 16;
+			putBytes64(at, fileBytes);
+			memcpy(at, W64_WAVE, 16); at += 16;
+			memcpy(at, W64_FMT, 16); at += 16;
+			putBytes64(at, W64_CHUNK_HEADER + fmtBytes);
+			putFormat(at, format);
+			memcpy(at, W64_DATA, 16); at += 16;
+			putBytes64(at, unknown ? WAV_UNKNOWN_SIZE : W64_CHUNK_HEADER + dataBytes);
+			return;
+		}
+
+		// sizes that do not fit are 0xFFFFFFFF, which is also what RF64 puts there
+		const bool rf64 = format.container == WavFormat::RF64
+			|| (format.container == WavFormat::AUTO && !unknown && fileBytes - 8 > 0xFFFFFFFFu);
+		auto size32 = [&](uint64_t size) {
+			return rf64 || unknown ? 0xFFFFFFFFu : (uint32_t) std::min<uint64_t>(size, 0xFFFFFFFFu);
+		};
+
+		memcpy(at, rf64 ? "RF64" : "RIFF", 4); at += 4;
+		putBytes(at, size32(fileBytes - 8), 4);
+		memcpy(at, "WAVE", 4); at += 4;
+		if (format.container != WavFormat::RIFF) {
+			memcpy(at, rf64 ? "ds64" : "JUNK", 4); at += 4;
+			putBytes(at, WAV_DS64_BYTES - 8, 4);
+			if (rf64) {
+				putBytes64(at, unknown ? WAV_UNKNOWN_SIZE : fileBytes - 8);
+				putBytes64(at, dataBytes);
+				putBytes64(at, unknown ? WAV_UNKNOWN_SIZE : dataBytes / format.frameBytes()); // frames
+				putBytes(at, 0, 4); // no table of other chunk sizes
+			} else {
+				memset(at, 0, WAV_DS64_BYTES - 8); at += WAV_DS64_BYTES - 8;
+			}
+		}
+		memcpy(at, "fmt ", 4); at += 4;
+		putBytes(at, fmtBytes, 4); // Subchunk1Size: size of the rest of the subchunk that follows this number
+		putFormat(at, format);
+		memcpy(at, "data", 4); at += 4;
+		putBytes(at, size32(dataBytes), 4);
+	}
+
+	/*
+		sample encoding
+	*/
+	void WavEncoder::encode(const float* samples, size_t count, char* out) {
+		// pcm keeps the headroom of the original 16 bit writer
+		const int PCM16_SCALE = 32760;
+		const int PCM24_SCALE = PCM16_SCALE << 8;
+		const size_t CHUNK = 1 << 16;
+
+		for (size_t done = 0; done < count; done += CHUNK) {
+			size_t n = std::min(count - done, CHUNK);
+			if (format.encoding == WavFormat::PCM16) {
+				int16_t* pcm = reinterpret_cast<int16_t*>(out) + done;
+				dsp::toPcm16(samples + done, pcm, n, PCM16_SCALE, PCM16_SCALE - 1);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+				for (size_t i = 0; i < n; ++i)
+					pcm[i] = (int16_t) __builtin_bswap16((uint16_t) pcm[i]);
+#endif
+			} else if (format.encoding == WavFormat::PCM24) {
+				dsp::toPcm24(samples + done, reinterpret_cast<uint8_t*>(out) + 3 * done, n, PCM24_SCALE, PCM24_SCALE - 1);
+			} else {
+				float* value = reinterpret_cast<float*>(out) + done;
+				memcpy(value, samples + done, n * sizeof(float));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+				for (size_t i = 0; i < n; ++i) {
+					uint32_t bits;
+					memcpy(&bits, value + i, 4);
+					bits = __builtin_bswap32(bits);
+					memcpy(value + i, &bits, 4);
+				}
+#endif
+			}
+		}
+	}
+
+	void WavEncoder::encodeFrames(const float* const* channels, size_t frames, char* out) {
+		if (format.channels == 1) {
+			encode(channels[0], frames, out);
+			return;
+		}
+		const size_t CHUNK = 4 * BLOCK_SIZE;
+		interleaved.resize(std::min(frames, CHUNK) * format.channels);
+		std::vector<const float*> from(channels, channels + format.channels);
+		for (size_t done = 0; done < frames; done += CHUNK) {
+			size_t n = std::min(frames - done, CHUNK);
+			dsp::interleave(from.data(), format.channels, interleaved.data(), n);
+			encode(interleaved.data(), n * format.channels, out + done * format.frameBytes());
+			for (const float*& channel : from)
+				channel += n;
+		}
+	}
+
 	/*
 		wav files
 	 */
-	WavFileWriter::WavFileWriter(const char* fname) {
-		sampleRate = 44100;
-		numChannels = 1;
-		bitsPerSample = 16;
-
-		maxAmplitude = 32760;
+	WavFileWriter::WavFileWriter(const char* fname, const WavFormat& format) : encoder(format) {
+		open(fname);
+	}
 
+	void WavFileWriter::open(const char* fname) {
+		if (f.is_open())
+			f.close();
+		f.clear();
 		f.open(fname, std::ios::binary);
+		if (!f.is_open())
+			throw std::runtime_error(std::string("could not open ") + fname + ": " + strerror(errno));
+		name = fname;
 	}
 
 	WavFileWriter::~WavFileWriter() {
-		if (f.is_open())
+		if (!f.is_open())
+			return;
+		try {
 			close();
+		} catch (const std::runtime_error&) {
+		}
 	}
 
-	void WavFileWriter::close() {
-		size_t file_length = f.tellp();
+	void WavFileWriter::check() {
+		if (!f)
+			throw std::runtime_error("could not write " + name + ": " + strerror(errno));
+	}
 
-		f.seekp(data_chunk_pos + 4);
-		writeBytes(file_length - data_chunk_pos + 8);
+	void WavFileWriter::close() {
+		uint64_t file_length = f.tellp();
 
-		f.seekp(0 + 4);
-		writeBytes(file_length - 8, 4 ); 
+		// the whole header is written again with the real sizes, an AUTO file turns into RF64 here if it has to
+		char header[WAV_MAX_HEADER_BYTES];
+		encodeWavHeader(header, getFormat(), file_length - getFormat().headerBytes());
+		f.seekp(0);
+		f.write(header, getFormat().headerBytes());
 
+		// closing flushes what is still buffered, so a full disk may only show up here
 		f.close();
+		check();
 	}
 
 	void WavFileWriter::writeHeader() {
-		// we leave 4 bytes with ---- so we have a place to fill in the size at the end!
-		f.write("RIFF    WAVEfmt ", 4 * 4);
-		
-		writeBytes(16, 4); // Subchunk1Size: sub chunk size: 16 for pcm, size of the rest of the subchunk that follows this number
-		writeBytes(1, 2); // AudioFormat: PCM = 1 linear quantization - indicates no compression
-		writeBytes(numChannels, 2); // NumChannels:  1 = mono.
-		writeBytes(sampleRate, 4); // sample rate.
-		writeBytes(numChannels * sampleRate * bitsPerSample / 8, 4); // ByteRate
-		writeBytes(numChannels * bitsPerSample / 8, 2); // BlockAlign
-		writeBytes(bitsPerSample, 2); // BitsPerSample
-
-		data_chunk_pos = f.tellp();
-		f.write("data    ", 4 * 2); // (chunk size to be filled in later)
+		// the sizes are written as 0 for now and filled in by close
+		char header[WAV_MAX_HEADER_BYTES];
+		encodeWavHeader(header, getFormat(), 0);
+		f.write(header, getFormat().headerBytes());
+		check();
 	}	
 
 	void WavFileWriter::writeSample(double sample) {
-		int value = (int) (sample * ((double) maxAmplitude));
-		if (value >= maxAmplitude) 
-			value = maxAmplitude - 1;
-		if (value <= -maxAmplitude)
-			value = -maxAmplitude + 1;
-		writeBytes(value, 2);
+		float value = sample;
+		char encoded[4];
+		encoder.encode(&value, 1, encoded);
+		f.write(encoded, getFormat().bitsPerSample() / 8);
+		check();
 	}
 
-	void WavFileWriter::writeBytes(int value, unsigned size) {
-		for (; size; --size, value >>= 8)
-			f.put(static_cast <char> (value & 0xFF));
+	void WavFileWriter::writeSamples(const float* samples, size_t frames) {
+		bytes.resize(frames * getFormat().frameBytes());
+		encoder.encode(samples, frames * getFormat().channels, bytes.data());
+		f.write(bytes.data(), bytes.size());
+		check();
 	}
+
+	void WavFileWriter::writeFrames(const float* const* channels, size_t frames) {
+		bytes.resize(frames * getFormat().frameBytes());
+		encoder.encodeFrames(channels, frames, bytes.data());
+		f.write(bytes.data(), bytes.size());
+		check();
+	}
+
 	
+
+	/*
+		memory mapped wav files
+	*/
+	MappedWavFileWriter::MappedWavFileWriter(const char* fname, size_t frames, const WavFormat& format) : frames(frames), format(format) {
+		size_t dataBytes = frames * format.frameBytes();
+		if (dataBytes > format.maxDataBytes())
+			throw std::runtime_error("render is too long for a RIFF wav file, use an AUTO, RF64 or W64 container");
+		mapBytes = format.headerBytes() + dataBytes;
+
+		fd = ::open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error(std::string("could not open ") + fname + ": " + strerror(errno));
+
+		// reserve the blocks up front so writes through the mapping never fail for lack of space
+		int failed = ftruncate(fd, mapBytes);
+#ifdef __linux__
+		if (!failed)
+			failed = posix_fallocate(fd, 0, mapBytes);
+#endif
+		if (failed) {
+			int error = failed > 0 ? failed : errno;
+			::close(fd);
+			throw std::runtime_error(std::string("could not allocate ") + fname + ": " + strerror(error));
+		}
+
+		void* memory = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			int error = errno;
+			::close(fd);
+			throw std::runtime_error(std::string("could not map ") + fname + ": " + strerror(error));
+		}
+		map = static_cast<char*>(memory);
+		encodeWavHeader(map, format, dataBytes);
+	}
+
+	MappedWavFileWriter::~MappedWavFileWriter() {
+		close();
+	}
+
+	void MappedWavFileWriter::close() {
+		if (map != nullptr) {
+			munmap(map, mapBytes);
+			map = nullptr;
+		}
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	// each thread writing to a mapped file converts with its own encoder
+	static WavEncoder& threadEncoder(const WavFormat& format) {
+		static thread_local std::unique_ptr<WavEncoder> encoder;
+		const WavFormat* current = encoder ? &encoder->getFormat() : nullptr;
+		if (!current || current->channels != format.channels || current->encoding != format.encoding)
+			encoder.reset(new WavEncoder(format));
+		return *encoder;
+	}
+
+	void MappedWavFileWriter::writeSamples(size_t frame, const float* samples, size_t count) {
+		if (frame >= frames)
+			return;
+		count = std::min(count, frames - frame);
+		threadEncoder(format).encode(samples, count * format.channels, frameAt(frame));
+	}
+
+	void MappedWavFileWriter::writeFrames(size_t frame, const float* const* channels, size_t count) {
+		if (frame >= frames)
+			return;
+		count = std::min(count, frames - frame);
+		threadEncoder(format).encodeFrames(channels, count, frameAt(frame));
+	}
+
+	/*
+		wav streams
+	*/
+	static volatile sig_atomic_t stopSignal = 0;
+
+	static void requestStop(int) {
+		stopSignal = 1;
+	}
+
+	void WavStreamWriter::stopOnSignals() {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		sigemptyset(&action.sa_mask);
+		action.sa_handler = requestStop;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+		action.sa_handler = SIG_IGN;
+		sigaction(SIGPIPE, &action, nullptr);
+	}
+
+	bool WavStreamWriter::stopRequested() {
+		return stopSignal != 0;
+	}
+
+	WavStreamWriter::WavStreamWriter(int fd, const WavFormat& format) : fd(fd), encoder(format), readerGone(false) {
+	}
+
+	void WavStreamWriter::writeHeader() {
+		char header[WAV_MAX_HEADER_BYTES];
+		encodeWavHeader(header, getFormat(), WAV_UNKNOWN_SIZE);
+		writeAll(header, getFormat().headerBytes());
+	}
+
+	bool WavStreamWriter::writeSamples(const float* samples, size_t frames) {
+		bytes.resize(frames * getFormat().frameBytes());
+		encoder.encode(samples, frames * getFormat().channels, bytes.data());
+		return writeAll(bytes.data(), bytes.size());
+	}
+
+	bool WavStreamWriter::writeFrames(const float* const* channels, size_t frames) {
+		bytes.resize(frames * getFormat().frameBytes());
+		encoder.encodeFrames(channels, frames, bytes.data());
+		return writeAll(bytes.data(), bytes.size());
+	}
+
+	bool WavStreamWriter::writeAll(const char* data, size_t count) {
+		while (count > 0 && !readerGone) {
+			ssize_t written = ::write(fd, data, count);
+			if (written < 0) {
+				// a signal that asked us to stop ends the stream at the end of the current block
+				if (errno == EINTR)
+					continue;
+				if (errno != EPIPE)
+					throw std::runtime_error(std::string("could not write wav stream: ") + strerror(errno));
+				readerGone = true;
+				break;
+			}
+			data += written;
+			count -= written;
+		}
+		return !readerGone;
+	}
+
+	/*
+		reading wav files
+	*/
+	static uint32_t getBytes(const char* at, unsigned size) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(at);
+		uint32_t value = 0;
+		for (unsigned i = size; i; --i)
+			value = (value << 8) | bytes[i - 1];
+		return value;
+	}
+
+	WavFileReader::WavFileReader(const char* fname) : map(nullptr), mapBytes(0), data(nullptr), frames(0) {
+		int fd = ::open(fname, O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(std::string("could not open ") + fname + ": " + strerror(errno));
+
+		off_t length = lseek(fd, 0, SEEK_END);
+		if (length < WAV_HEADER_BYTES) {
+			::close(fd);
+			throw std::runtime_error(std::string(fname) + " is too short to be a wav file");
+		}
+		mapBytes = length;
+
+		// the mapping stays valid after the descriptor is closed
+		void* memory = mmap(nullptr, mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		int error = errno;
+		::close(fd);
+		if (memory == MAP_FAILED)
+			throw std::runtime_error(std::string("could not map ") + fname + ": " + strerror(error));
+		map = static_cast<const char*>(memory);
+
+		try {
+			parse();
+		} catch (const std::runtime_error& e) {
+			munmap(const_cast<char*>(map), mapBytes);
+			throw std::runtime_error(std::string(fname) + ": " + e.what());
+		}
+	}
+
+	WavFileReader::~WavFileReader() {
+		munmap(const_cast<char*>(map), mapBytes);
+	}
+
+	static uint64_t getBytes64(const char* at) {
+		return getBytes(at, 4) | (uint64_t) getBytes(at + 4, 4) << 32;
+	}
+
+	void WavFileReader::parse() {
+		const char* end = map + mapBytes;
+		int format = -1;
+		uint64_t dataBytes = 0;
+
+		auto readFormat = [&](const char* body, uint64_t size) {
+			if (size < 16 || size > (uint64_t) (end - body))
+				throw std::runtime_error("broken fmt chunk");
+			format = getBytes(body, 2);
+			numChannels = getBytes(body + 2, 2);
+			sampleRate = getBytes(body + 4, 4);
+			bitsPerSample = getBytes(body + 14, 2);
+			// the sub format guid starts with the format tag
+			if (format == FORMAT_EXTENSIBLE && size >= 40)
+				format = getBytes(body + 24, 2);
+		};
+
+		if (mapBytes >= 40 && memcmp(map, W64_RIFF, 16) == 0 && memcmp(map + 24, W64_WAVE, 16) == 0) {
+			// W64 chunks have a guid, a 64 bit size including the chunk header and are 8 byte aligned
+			const char* chunk = map + 40;
+			while (chunk + W64_CHUNK_HEADER <= end) {
+				const char* body = chunk + W64_CHUNK_HEADER;
+				uint64_t size = getBytes64(chunk + 16);
+				uint64_t available = end - body;
+				if (size < W64_CHUNK_HEADER)
+					throw std::runtime_error("broken chunk");
+				size -= W64_CHUNK_HEADER;
+
+				if (memcmp(chunk, W64_FMT, 16) == 0) {
+					readFormat(body, size);
+				} else if (memcmp(chunk, W64_DATA, 16) == 0) {
+					if (format < 0)
+						throw std::runtime_error("data chunk before fmt chunk");
+					data = body;
+					dataBytes = size;
+					break;
+				}
+
+				if (size > available)
+					break;
+				chunk = body + ((size + 7) & ~(uint64_t) 7);
+			}
+		} else {
+			bool rf64 = memcmp(map, "RF64", 4) == 0;
+			if ((!rf64 && memcmp(map, "RIFF", 4) != 0) || memcmp(map + 8, "WAVE", 4) != 0)
+				throw std::runtime_error("not a RIFF, RF64 or W64 WAVE file");
+
+			uint64_t ds64DataBytes = WAV_UNKNOWN_SIZE;
+			const char* chunk = map + 12;
+			while (chunk + 8 <= end) {
+				const char* body = chunk + 8;
+				uint64_t size = getBytes(chunk + 4, 4);
+				uint64_t available = end - body;
+
+				if (memcmp(chunk, "fmt ", 4) == 0) {
+					readFormat(body, size);
+				} else if (memcmp(chunk, "ds64", 4) == 0 && size >= 24 && size <= available) {
+					ds64DataBytes = getBytes64(body + 8);
+				} else if (memcmp(chunk, "data", 4) == 0) {
+					if (format < 0)
+						throw std::runtime_error("data chunk before fmt chunk");
+					data = body;
+					dataBytes = rf64 && size == 0xFFFFFFFFu ? ds64DataBytes : size;
+					break;
+				}
+
+				// chunks are padded to an even number of bytes
+				if (size > available)
+					break;
+				chunk = body + size + (size & 1);
+			}
+		}
+
+		if (data == nullptr)
+			throw std::runtime_error("no data chunk");
+		if (numChannels < 1)
+			throw std::runtime_error("no channels");
+
+		if (format == FORMAT_PCM)
+			floatSamples = false;
+		else if (format == FORMAT_FLOAT)
+			floatSamples = true;
+		else
+			throw std::runtime_error("unsupported sample format " + std::to_string(format));
+
+		bool supported = floatSamples ? (bitsPerSample == 32 || bitsPerSample == 64)
+			: (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+		if (!supported)
+			throw std::runtime_error("unsupported sample size of " + std::to_string(bitsPerSample) + " bits");
+
+		// a truncated file, or one whose sizes were never filled in, plays up to where it ends
+		dataBytes = std::min<uint64_t>(dataBytes, end - data);
+		frames = dataBytes / (numChannels * bitsPerSample / 8);
+	}
+
+	// sums channels samples of sampleBytes each, frameBytes apart, for count frames
+	template<class Decode>
+	static void decodeFrames(const char* at, int frameBytes, int sampleBytes, int channels, float* out, size_t count, Decode value) {
+		if (channels == 1) {
+			for (size_t i = 0; i < count; ++i, at += frameBytes)
+				out[i] = value(at);
+			return;
+		}
+		float mix = 1.0f / channels;
+		for (size_t i = 0; i < count; ++i, at += frameBytes) {
+			float sum = 0;
+			for (int c = 0; c < channels; ++c)
+				sum += value(at + c * sampleBytes);
+			out[i] = sum * mix;
+		}
+	}
+
+	void WavFileReader::read(size_t frame, float* out, size_t count, int channel) const {
+		size_t available = frame < frames ? std::min(count, frames - frame) : 0;
+		std::fill(out + available, out + count, 0.0f);
+		if (available == 0)
+			return;
+
+		int sampleBytes = bitsPerSample / 8;
+		int frameBytes = numChannels * sampleBytes;
+		int channels = channel < 0 ? numChannels : 1;
+		const char* at = data + frame * frameBytes + (channel < 0 ? 0 : channel * sampleBytes);
+
+		if (floatSamples && bitsPerSample == 32) {
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				uint32_t bits = getBytes(p, 4);
+				float value;
+				memcpy(&value, &bits, 4);
+				return value;
+			});
+		} else if (floatSamples) {
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				uint64_t bits = getBytes(p, 4) | (uint64_t) getBytes(p + 4, 4) << 32;
+				double value;
+				memcpy(&value, &bits, 8);
+				return (float) value;
+			});
+		} else if (bitsPerSample == 8) {
+			// 8 bit samples are unsigned
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				return ((int) getBytes(p, 1) - 128) * (1.0f / 128);
+			});
+		} else if (bitsPerSample == 16) {
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				return (int16_t) getBytes(p, 2) * (1.0f / 32768);
+			});
+		} else if (bitsPerSample == 24) {
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				// shift the sign bit into place, then back down
+				return (int32_t) (getBytes(p, 3) << 8) * (1.0f / 2147483648.0f);
+			});
+		} else {
+			decodeFrames(at, frameBytes, sampleBytes, channels, out, available, [](const char* p) {
+				return (int32_t) getBytes(p, 4) * (1.0f / 2147483648.0f);
+			});
+		}
+	}
+
+	/*
+		samples
+	*/
+	SampleSource::SampleSource(const char* fname, int channel) : SampleSource(std::make_shared<const WavFileReader>(fname), channel) {
+	}
+
+	SampleSource::SampleSource(std::shared_ptr<const WavFileReader> reader, int channel)
+		: reader(reader), channel(channel), length(std::min<size_t>(reader->getFrames(), FOREVER)) {
+		if (channel >= reader->getChannels())
+			throw std::runtime_error("the file has no channel " + std::to_string(channel));
+	}
+
+	void SampleSource::_render(const Context& context, float* out, int frames) {
+		// before the start of the file, e.g. when shifted
+		if (context.time < 0) {
+			int silent = std::min(frames, -context.time);
+			std::fill(out, out + silent, 0.0f);
+			if (silent == frames)
+				return;
+			Context c(context);
+			c.time += silent;
+			_render(c, out + silent, frames - silent);
+			return;
+		}
+		if (!reader) {
+			std::fill(out, out + frames, 0.0f);
+			return;
+		}
+		reader->read(context.time, out, frames, channel);
+	}
+
 }
\ No newline at end of file
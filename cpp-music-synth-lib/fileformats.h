@@ -2,51 +2,398 @@
 #define __WAVEFILE_H_
 
 #include <fstream>
+#include <stdexcept>
+#include <vector>
 #include "synth2.h"
 
 namespace synth {
 
+	const int WAV_HEADER_BYTES = 44;            // plain pcm
+	const int WAV_EXTENSIBLE_HEADER_BYTES = 68; // WAVE_FORMAT_EXTENSIBLE
+	const int WAV_DS64_BYTES = 36;              // the ds64 chunk of RF64, or the JUNK chunk holding its place
+	const int WAV_MAX_HEADER_BYTES = 128;       // W64 with WAVE_FORMAT_EXTENSIBLE
+	const uint64_t WAV_UNKNOWN_SIZE = ~0ull;    // the data size of a stream that has no end yet
+
+	/*
+		the sample layout of a wav file being written.
+		more than 2 channels or more than 16 bits are written with a
+		WAVE_FORMAT_EXTENSIBLE header, the speaker mask assigns the channels to
+		the standard speaker positions in order (left, right, center, lfe, ...).
+
+		the container decides how big the file can get:
+			RIFF  plain wav, the 32 bit sizes limit it to 4gb
+			RF64  EBU Tech 3306, wav with a ds64 chunk holding 64 bit sizes
+			W64   Sonic Foundry Wave64, the SF_FORMAT_W64 of libsndfile
+			AUTO  a wav with a JUNK chunk where the ds64 chunk would go. it stays a
+			      plain wav as long as the data fits and is turned into RF64 in
+			      place when the final size is written if it does not, so writers
+			      that only find out the size at the end need no second pass.
+
+		usage: WavFormat(2, WavFormat::FLOAT32)
+	*/
+	struct WavFormat {
+		enum Encoding { PCM16, PCM24, FLOAT32 };
+		enum Container { AUTO, RIFF, RF64, W64 };
+
+		int channels;
+		Encoding encoding;
+		int sampleRate;
+		Container container;
+
+		WavFormat(int channels = 1, Encoding encoding = PCM16, int sampleRate = SAMPLES_PER_SECOND, Container container = AUTO)
+			: channels(channels), encoding(encoding), sampleRate(sampleRate), container(container) { };
+
+		int bitsPerSample() const {
+			return encoding == PCM16 ? 16 : encoding == PCM24 ? 24 : 32;
+		}
+
+		int frameBytes() const {
+			return channels * bitsPerSample() / 8;
+		}
+
+		bool extensible() const {
+			return channels > 2 || bitsPerSample() > 16;
+		}
+
+		int headerBytes() const {
+			int riff = extensible() ? WAV_EXTENSIBLE_HEADER_BYTES : WAV_HEADER_BYTES;
+			if (container == RIFF)
+				return riff;
+			// W64 chunk headers take 24 bytes instead of 8, ds64 and JUNK add one chunk
+			return container == W64 ? riff + 3 * 16 + 12 : riff + WAV_DS64_BYTES;
+		}
+
+		// the largest amount of sample data the container can describe
+		uint64_t maxDataBytes() const {
+			return container == RIFF ? 0xFFFFFFFFu - headerBytes() : ~0ull >> 1;
+		}
+	};
+
+	/*
+		fills in the format.headerBytes() long header of a file holding dataBytes of samples.
+		an AUTO header is written as RF64 if dataBytes do not fit into a plain wav,
+		WAV_UNKNOWN_SIZE writes the sizes streaming readers take as "until the end".
+	*/
+	void encodeWavHeader(char* out, const WavFormat& format, uint64_t dataBytes);
+
+	/*
+		converts interleaved float samples to the bytes of a format.
+		pcm is clamped just below full scale, float samples are stored as they are.
+	*/
+	class WavEncoder {
+	private:
+		WavFormat format;
+		std::vector<float> interleaved; // reused by encodeFrames
+
+	public:
+		WavEncoder(const WavFormat& format) : format(format) { };
+
+		const WavFormat& getFormat() const {
+			return format;
+		}
+
+		// encodes count samples, whatever channels they belong to
+		void encode(const float* samples, size_t count, char* out);
+		// interleaves one block per channel and encodes it
+		void encodeFrames(const float* const* channels, size_t frames, char* out);
+	};
+
+	// the longest of the sources, each needs a getDuration()
+	template<class... T>
+	int longestOf(SoundSource<T>&... sources) {
+		int duration = 0;
+		for (int length : { (int) sources.get_ref().getDuration()... })
+			duration = std::max(duration, length);
+		return duration;
+	}
+
+	// renders a block of one channel and adds it to the channel's history
+	template<class T>
+	void renderBlock(SoundSource<T>& source, const Context& context, float* out, int frames, History& history) {
+		source.render(context, out, frames);
+		history.append(out, frames);
+	}
+
+	/*
+		renders one source per channel into planar blocks of chunkFrames and
+		hands every chunk to write(time, channels, frames), until duration or
+		until write returns false. each source sees its own output in the
+		history of its context, which is kept up to date a block at a time.
+		used by the writers, memory use is fixed whatever the duration.
+	*/
+	template<class Write, class... T>
+	Time renderChannels(int channelCount, Time duration, int chunkFrames, Write write, SoundSource<T>&... sources) {
+		const int CHANNELS = sizeof...(T);
+		if (CHANNELS != channelCount)
+			throw std::runtime_error("render needs one source per channel");
+
+		std::vector<History> histories(CHANNELS);
+		std::vector<float> blocks(CHANNELS * chunkFrames);
+		const float* channels[CHANNELS];
+		for (int k = 0; k < CHANNELS; ++k)
+			channels[k] = blocks.data() + k * chunkFrames;
+
+		Time time = 0;
+		while (time < duration) {
+			int frames = std::min<Time>(chunkFrames, duration - time);
+			for (int done = 0; done < frames; done += BLOCK_SIZE) {
+				int n = std::min(BLOCK_SIZE, frames - done);
+				int k = 0;
+				// renders the sources into their blocks in channel order
+				int expand[] = { (renderBlock(sources, Context(time + done, duration, &histories[k]),
+					blocks.data() + k * chunkFrames + done, n, histories[k]), ++k)... };
+				(void) expand;
+			}
+			bool more = write(time, channels, frames);
+			time += frames;
+			if (!more)
+				break;
+		}
+		return time;
+	}
+
 	class WavFileWriter {
 	private:
 		std::ofstream f;
+		std::string name; // of the open file, for errors
 
 		constexpr static double twoPi = 6.28318530;
 
-		size_t data_chunk_pos;
-		int sampleRate;
-		int numChannels;
-		int bitsPerSample;
-		int maxAmplitude;
+		WavEncoder encoder;
 
-		void writeBytes(int value, unsigned size = 4);
+		std::vector<char> bytes; // reused by writeSamples
+
+		// throws if a write to the file failed, e.g. when the disk is full
+		void check();
 
 	public:
-		WavFileWriter(const char* fname);
+		// throws std::runtime_error if the file can not be created, and from
+		// any of the writes and close if the file can not be written
+		WavFileWriter(const char* fname, const WavFormat& format = WavFormat());
+		// closes a file that is still open, errors are lost, call close to see them
 		~WavFileWriter();
 
+		// starts another file of the same format, reusing the buffers of the writer.
+		// a file still open, e.g. after a failed write, is dropped first
+		void open(const char* fname);
+
+		const WavFormat& getFormat() const {
+			return encoder.getFormat();
+		}
+
 		void writeHeader();
 		void writeSample(double sample);
+		// converts a whole block of interleaved frames at once and writes it with a single call
+		void writeSamples(const float* samples, size_t frames);
+		// the same for one block per channel
+		void writeFrames(const float* const* channels, size_t frames);
 		void close();
 
-		template<class T>
-		void render(Finite<T>& source) {
-			int duration = source.getDuration();
-			float* array = new float[duration];
-			Context c(0, duration, array);
-			for (int i = 0; i < source.getDuration(); ++i) {
-				c.time = i;
-				writeSample(source.sample(c));
-			}
-			delete[] array;
+		// renders one source per channel, each with a getDuration(), i.e. a Finite or a Sequence.
+		// the file is as long as the longest of them.
+		// usage: writer.render(left, right);
+		template<class... T>
+		void render(SoundSource<T>&... sources) {
+			renderChannels(getFormat().channels, longestOf(sources...), 16 * BLOCK_SIZE, [&](Time, const float* const* channels, int frames) {
+				writeFrames(channels, frames);
+				return true;
+			}, sources...);
+		}
+	};
+
+	/*
+		writes a wav file of a length known up front through a memory mapping.
+		the file is created at its final size with the final header, so there is
+		nothing to patch up at the end, and every frame has a fixed place in the
+		file. writeSamples converts straight into the mapping and can be called
+		from several threads at once as long as they write disjoint frames.
+		throws std::runtime_error if the file can not be created or mapped.
+
+		usage:
+			MappedWavFileWriter out("song.wav", song.getDuration());
+			out.render(song);  // or ParallelRenderer::render(out, song)
+			out.close();
+	*/
+	class MappedWavFileWriter {
+	private:
+		int fd;
+		char* map;
+		size_t mapBytes;
+		size_t frames;
+		WavFormat format;
+
+		char* frameAt(size_t frame) {
+			return map + format.headerBytes() + frame * format.frameBytes();
+		}
+
+	public:
+		MappedWavFileWriter(const char* fname, size_t frames, const WavFormat& format = WavFormat());
+		~MappedWavFileWriter();
+
+		MappedWavFileWriter(const MappedWavFileWriter&) = delete;
+		MappedWavFileWriter& operator = (const MappedWavFileWriter&) = delete;
+
+		size_t getFrames() const {
+			return frames;
+		}
+
+		const WavFormat& getFormat() const {
+			return format;
+		}
+
+		// stores count interleaved frames starting at the given frame, anything past the end of the file is dropped
+		void writeSamples(size_t frame, const float* samples, size_t count);
+		// the same for one block per channel
+		void writeFrames(size_t frame, const float* const* channels, size_t count);
+		void close();
+
+		// one source per channel, see WavFileWriter::render
+		template<class... T>
+		void render(SoundSource<T>&... sources) {
+			int duration = std::min((size_t) longestOf(sources...), frames);
+			renderChannels(format.channels, duration, 16 * BLOCK_SIZE, [&](Time time, const float* const* channels, int count) {
+				writeFrames(time, channels, count);
+				return true;
+			}, sources...);
 		}
 	};
 
 	/*
-		TODO: tutorial on how to actually use this for nonstandard configurations.
+		writes a wav stream to a pipe, socket or anything else that can not seek.
+		the header is written up front with WAV_UNKNOWN_SIZE as the chunk sizes,
+		which is what streaming readers (ffmpeg, sox, ...) expect, and nothing is
+		ever patched up afterwards. sources are rendered and written a few blocks
+		at a time, so memory use is fixed however long the stream runs.
 
+		streaming stops when the stop condition says so, when stopOnSignals() has
+		been called and SIGINT or SIGTERM arrive, or when the reader closes its end
+		(EPIPE). without stopOnSignals(), which also ignores SIGPIPE, a closed pipe
+		ends the process like it would for any other program writing to it.
+		other write errors throw std::runtime_error. time is an int, so a stream
+		also ends after FOREVER frames (about 13 hours at 44100hz).
+
+		usage:
+			WavStreamWriter::stopOnSignals();
+			WavStreamWriter out(STDOUT_FILENO);
+			out.writeHeader();
+			auto tone = SinWave(freq(440));
+			out.stream(tone);  // ./program | ffmpeg -i - out.mp3
+	*/
+	class WavStreamWriter {
+	private:
+		int fd;
+		WavEncoder encoder;
+		std::vector<char> bytes; // reused by writeSamples
+		bool readerGone;
+
+		bool writeAll(const char* data, size_t count);
+
+	public:
+		// fd is not closed by the writer
+		WavStreamWriter(int fd, const WavFormat& format = WavFormat());
+
+		const WavFormat& getFormat() const {
+			return encoder.getFormat();
+		}
+
+		// false once the reader has closed its end
+		bool open() const {
+			return !readerGone;
+		}
+
+		void writeHeader();
+		// interleaved frames, false if the reader has gone away
+		bool writeSamples(const float* samples, size_t frames);
+		// one block per channel, false if the reader has gone away
+		bool writeFrames(const float* const* channels, size_t frames);
+
+		// SIGINT and SIGTERM make stream() return instead of ending the process, SIGPIPE is ignored
+		static void stopOnSignals();
+		static bool stopRequested();
+
+		// renders one source per channel until stop(time) returns true, time being the
+		// next frame to render. it is asked every 4 blocks. returns the frames written
+		template<class Stop, class... T>
+		Time streamUntil(Stop stop, SoundSource<T>&... sources) {
+			if (!open() || stopRequested() || stop(0))
+				return 0;
+			return renderChannels(getFormat().channels, FOREVER, 4 * BLOCK_SIZE, [&](Time time, const float* const* channels, int frames) {
+				return writeFrames(channels, frames) && !stopRequested() && !stop(time + frames);
+			}, sources...);
+		}
+
+		// renders until a signal arrives or the reader goes away
+		template<class... T>
+		Time stream(SoundSource<T>&... sources) {
+			return streamUntil([](Time) { return false; }, sources...);
+		}
+	};
+
+	/*
+		reads pcm (8, 16, 24 or 32 bit) and float (32 or 64 bit) wav files,
+		including WAVE_FORMAT_EXTENSIBLE ones, in RIFF, RF64 or W64 containers. the file is mapped read only and
+		only the chunk headers are parsed when it is opened, samples are decoded
+		when they are read, so a big file costs page cache rather than heap.
+		throws std::runtime_error if the file can not be mapped or is not a wav
+		file it understands.
+
+		usage:
+			auto reader = std::make_shared<WavFileReader>("test.wav");
+			auto left = SampleSource(reader, 0);
+			auto right = SampleSource(reader, 1);
+	*/
+	class WavFileReader {
+	private:
+		const char* map;
+		size_t mapBytes;
+
+		const char* data; // first frame
+		size_t frames;
+		int sampleRate;
+		int numChannels;
+		int bitsPerSample;
+		bool floatSamples;
+
+		void parse();
+
+	public:
+		WavFileReader(const char* fname);
+		~WavFileReader();
+
+		WavFileReader(const WavFileReader&) = delete;
+		WavFileReader& operator = (const WavFileReader&) = delete;
+
+		size_t getFrames() const {
+			return frames;
+		}
+
+		int getSampleRate() const {
+			return sampleRate;
+		}
+
+		int getChannels() const {
+			return numChannels;
+		}
+
+		int getBitsPerSample() const {
+			return bitsPerSample;
+		}
+
+		bool isFloat() const {
+			return floatSamples;
+		}
+
+		// decodes count frames of one channel starting at frame into out, scaled to [-1, 1].
+		// channel -1 averages all channels, frames past the end of the file are silent
+		void read(size_t frame, float* out, size_t count, int channel = -1) const;
+	};
+
+	/*
 		TUTORIAL:
 		default sample rate is 44100
 		default numChannels is 1 since it's mono.
+		for anything else pass a WavFormat, e.g. WavFileWriter("out.wav", WavFormat(2, WavFormat::PCM24))
+		and render one source per channel with render(left, right).
 		
 		you must begin by callind writeHeader once you have finished setting up settings!
 		you must take (sample rate) samples per second and use writeSample to write them to the file.
@@ -1,6 +1,7 @@
 #include <iostream>
 #include "synth2.h"
 #include "fileformats.h"
+#include "parallel.h"
 
 
 using namespace synth;
@@ -14,14 +15,15 @@ auto overtones(int f) {
 int main() {
 	synth::WavFileWriter test("test.wav");
 
-	auto a = finiteOf(finiteOf(envelopeOf(overtones(220)), seconds(0.25)), seconds(0.4));
-	auto b = finiteOf(finiteOf(envelopeOf(overtones(440)), seconds(0.25)), seconds(0.4));
-	auto c = finiteOf(finiteOf(envelopeOf(overtones(880)), seconds(0.25)), seconds(0.4));
+	auto a = finiteOf(envelopeOf(finiteOf(overtones(220), seconds(0.25))), seconds(0.4));
+	auto b = finiteOf(envelopeOf(finiteOf(overtones(440), seconds(0.25))), seconds(0.4));
+	auto c = finiteOf(envelopeOf(finiteOf(overtones(880), seconds(0.25))), seconds(0.4));
 
-	auto sound = a << b << c << a << b << c << c << a << b;
+	auto sound = sequenceOf(a, b, c, a, b, c, c, a, b);
 	auto sound2 = sound * ConstValue(0.2);
+	ParallelRenderer renderer(std::thread::hardware_concurrency());
 	test.writeHeader();
-	test.render(sound);
+	renderer.render(test, sound);
 	test.close();
 
 }
@@ -0,0 +1,135 @@
+#ifndef __PARALLEL_H_
+#define __PARALLEL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "synth2.h"
+#include "fileformats.h"
+#include "threadpool.h"
+
+namespace synth {
+
+	/*
+		renders a Finite source (or a Sequence) into a mono file on several threads at once.
+		the song is cut into chunks of chunkFrames samples, the chunks are rendered
+		on a thread pool and handed to the WavFileWriter in order as they complete.
+		at most two chunks per thread are in flight, so memory use does not depend
+		on the length of the song.
+
+		only stateless sources (see SoundSourceBase::stateless) are split up, the
+		source is shared between the threads so its render must not modify it.
+		anything else is rendered on the calling thread exactly like WavFileWriter::render.
+
+		usage:
+			ParallelRenderer renderer(8);
+			writer.writeHeader();
+			renderer.render(writer, song);
+			writer.close();
+
+		rendering into a MappedWavFileWriter skips the ordering, each worker writes
+		its chunk into its own part of the file.
+	*/
+	class ParallelRenderer {
+	private:
+		ThreadPool pool;
+		int chunkFrames;
+
+	public:
+		ParallelRenderer(int threads, int chunkFrames = 64 * BLOCK_SIZE) : pool(threads), chunkFrames(chunkFrames) { };
+
+		int threads() const {
+			return pool.size();
+		}
+
+		// source is anything with a getDuration(), i.e. a Finite or a Sequence.
+		// writer is a WavFileWriter or an AsyncWavFileWriter, anything with writeSamples(samples, frames)
+		template<class Writer, class T>
+		void render(Writer& writer, SoundSource<T>& source) {
+			if (pool.size() < 2 || !source.stateless() || writer.getFormat().channels != 1) {
+				writer.render(source);
+				return;
+			}
+
+			const int duration = source.get_ref().getDuration();
+			const int chunkCount = (duration + chunkFrames - 1) / chunkFrames;
+			const int window = std::min(chunkCount, 2 * pool.size());
+
+			// chunk k is rendered into slot k % window
+			std::vector<std::vector<float>> slots(window, std::vector<float>(chunkFrames));
+			std::vector<bool> ready(window, false);
+			std::mutex lock;
+			std::condition_variable done;
+
+			auto submit = [&](int chunk) {
+				pool.submit([&, chunk] {
+					int start = chunk * chunkFrames;
+					int frames = std::min(chunkFrames, duration - start);
+					Context c(start, duration, nullptr);
+					source.render(c, slots[chunk % window].data(), frames);
+					// notify under the lock, the caller may return and destroy done as soon as it sees the flag
+					std::lock_guard<std::mutex> guard(lock);
+					ready[chunk % window] = true;
+					done.notify_all();
+				});
+			};
+
+			for (int chunk = 0; chunk < window; ++chunk)
+				submit(chunk);
+
+			for (int chunk = 0; chunk < chunkCount; ++chunk) {
+				int slot = chunk % window;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					done.wait(guard, [&] { return ready[slot]; });
+					ready[slot] = false;
+				}
+
+				int frames = std::min(chunkFrames, duration - chunk * chunkFrames);
+				writer.writeSamples(slots[slot].data(), frames);
+
+				if (chunk + window < chunkCount)
+					submit(chunk + window);
+			}
+		}
+
+		// with a mapped file every chunk has its own place in the output, so the
+		// workers write their chunk straight into the file in whatever order they finish
+		template<class T>
+		void render(MappedWavFileWriter& writer, SoundSource<T>& source) {
+			if (pool.size() < 2 || !source.stateless() || writer.getFormat().channels != 1) {
+				writer.render(source);
+				return;
+			}
+
+			const int duration = std::min((size_t) source.get_ref().getDuration(), writer.getFrames());
+			const int chunkCount = (duration + chunkFrames - 1) / chunkFrames;
+
+			std::mutex lock;
+			std::condition_variable done;
+			int remaining = chunkCount;
+
+			for (int chunk = 0; chunk < chunkCount; ++chunk) {
+				pool.submit([&, chunk] {
+					int start = chunk * chunkFrames;
+					int frames = std::min(chunkFrames, duration - start);
+					std::vector<float> block(frames);
+					Context c(start, duration, nullptr);
+					source.render(c, block.data(), frames);
+					writer.writeSamples(start, block.data(), frames);
+
+					std::lock_guard<std::mutex> guard(lock);
+					--remaining;
+					done.notify_all();
+				});
+			}
+
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [&] { return remaining == 0; });
+		}
+	};
+
+};
+
+#endif
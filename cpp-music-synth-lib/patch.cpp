@@ -0,0 +1,475 @@
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include "patch.h"
+
+namespace synth {
+
+	/*
+		building graphs
+	*/
+	int PatchGraph::addNode(PatchNode::Kind kind, std::vector<int> inputs) {
+		for (int input : inputs)
+			if (input < 0 || input >= (int) nodes.size())
+				throw std::runtime_error("patch node refers to a node that does not exist");
+		PatchNode node;
+		node.kind = kind;
+		node.inputs = std::move(inputs);
+		node.value = 0;
+		node.time = 0;
+		nodes.push_back(node);
+		output = nodes.size() - 1;
+		return output;
+	}
+
+	int PatchGraph::sin(float period) {
+		int id = addNode(PatchNode::SIN, {});
+		nodes[id].value = period;
+		return id;
+	}
+
+	int PatchGraph::constant(float value) {
+		int id = addNode(PatchNode::CONST, {});
+		nodes[id].value = value;
+		return id;
+	}
+
+	int PatchGraph::add(const std::vector<int>& inputs) {
+		if (inputs.empty())
+			throw std::runtime_error("add needs at least one input");
+		return addNode(PatchNode::ADD, inputs);
+	}
+
+	int PatchGraph::mul(const std::vector<int>& inputs) {
+		if (inputs.empty())
+			throw std::runtime_error("mul needs at least one input");
+		return addNode(PatchNode::MUL, inputs);
+	}
+
+	int PatchGraph::shift(int input, Time amount) {
+		int id = addNode(PatchNode::SHIFT, { input });
+		nodes[id].time = amount;
+		return id;
+	}
+
+	int PatchGraph::window(int input, Time duration) {
+		int id = addNode(PatchNode::WINDOW, { input });
+		nodes[id].time = duration;
+		return id;
+	}
+
+	int PatchGraph::envelope(int input, const Adsr& shape, Time length) {
+		int id = addNode(PatchNode::ENVELOPE, { input });
+		nodes[id].shape = shape;
+		nodes[id].time = length;
+		return id;
+	}
+
+	/*
+		parsing
+	*/
+	PatchGraph PatchGraph::parse(std::istream& in) {
+		PatchGraph graph;
+		std::map<std::string, int> names;
+		std::string line;
+		int lineNumber = 0;
+
+		while (std::getline(in, line)) {
+			++lineNumber;
+			line = line.substr(0, line.find('#'));
+			std::stringstream words(line);
+			std::vector<std::string> tokens;
+			std::string token;
+			while (words >> token)
+				tokens.push_back(token);
+			if (tokens.empty())
+				continue;
+
+			std::stringstream where;
+			where << "patch line " << lineNumber << ": ";
+
+			auto node = [&](const std::string& name) {
+				auto found = names.find(name);
+				if (found == names.end())
+					throw std::runtime_error(where.str() + "unknown node '" + name + "'");
+				return found->second;
+			};
+			auto number = [&](size_t i) {
+				if (i >= tokens.size())
+					throw std::runtime_error(where.str() + "missing argument");
+				std::stringstream ss(tokens[i]);
+				float value;
+				if (!(ss >> value))
+					throw std::runtime_error(where.str() + "expected a number, got '" + tokens[i] + "'");
+				return value;
+			};
+			auto arguments = [&](size_t count) {
+				if (tokens.size() != count + 3)
+					throw std::runtime_error(where.str() + "wrong number of arguments to " + tokens[2]);
+			};
+
+			if (tokens[0] == "output") {
+				if (tokens.size() != 2)
+					throw std::runtime_error(where.str() + "usage: output <node>");
+				graph.output = node(tokens[1]);
+				continue;
+			}
+
+			if (tokens.size() < 3 || tokens[1] != "=")
+				throw std::runtime_error(where.str() + "expected '<name> = <op> ...'");
+
+			const std::string& op = tokens[2];
+			int id;
+			if (op == "sin") {
+				arguments(1);
+				float hz = number(3);
+				if (hz <= 0)
+					throw std::runtime_error(where.str() + "frequency must be positive");
+				id = graph.sin(SAMPLES_PER_SECOND / hz);
+			} else if (op == "const") {
+				arguments(1);
+				id = graph.constant(number(3));
+			} else if (op == "add" || op == "mul") {
+				std::vector<int> inputs;
+				for (size_t i = 3; i < tokens.size(); ++i)
+					inputs.push_back(node(tokens[i]));
+				if (inputs.empty())
+					throw std::runtime_error(where.str() + op + " needs at least one input");
+				id = op == "add" ? graph.add(inputs) : graph.mul(inputs);
+			} else if (op == "shift") {
+				arguments(2);
+				id = graph.shift(node(tokens[3]), seconds(number(4)));
+			} else if (op == "window") {
+				arguments(2);
+				id = graph.window(node(tokens[3]), seconds(number(4)));
+			} else if (op == "envelope") {
+				Adsr::Curve curve = Adsr::LINEAR;
+				if (tokens.size() == 10) {
+					if (tokens[9] == "exponential")
+						curve = Adsr::EXPONENTIAL;
+					else if (tokens[9] != "linear")
+						throw std::runtime_error(where.str() + "unknown envelope curve '" + tokens[9] + "'");
+				} else {
+					arguments(6);
+				}
+				Adsr shape(seconds(number(4)), seconds(number(5)), number(6), seconds(number(7)), curve);
+				id = graph.envelope(node(tokens[3]), shape, seconds(number(8)));
+			} else {
+				throw std::runtime_error(where.str() + "unknown operation '" + op + "'");
+			}
+			names[tokens[0]] = id;
+		}
+
+		if (graph.output < 0)
+			throw std::runtime_error("patch has no nodes");
+		return graph;
+	}
+
+	PatchGraph PatchGraph::load(const char* fname) {
+		std::ifstream f(fname);
+		if (!f.is_open())
+			throw std::runtime_error(std::string("could not open patch ") + fname);
+		return parse(f);
+	}
+
+	/*
+		compiling
+		the graph is lowered depth first. a node reached through shifts is emitted
+		once per distinct time offset, SHIFT itself only moves the offset of its
+		input and gates everything before the shift point. every instruction first
+		writes a new value, registers are then assigned by reusing a register as
+		soon as the last instruction reading its value has run.
+	*/
+	namespace {
+		struct Lowering {
+			const PatchGraph& graph;
+			std::vector<PatchProgram::Instruction> code;
+			std::map<std::pair<int, Time>, int> emitted; // (node, offset) -> value
+
+			Lowering(const PatchGraph& graph) : graph(graph) { };
+
+			PatchProgram::Instruction blank(PatchProgram::Op op, Time offset) {
+				PatchProgram::Instruction ins;
+				ins.op = op;
+				ins.out = ins.a = ins.b = -1;
+				ins.active = TimeRange::always();
+				ins.offset = offset;
+				ins.value = 0;
+				ins.from = 0;
+				ins.to = FOREVER;
+				return ins;
+			}
+
+			int push(const PatchProgram::Instruction& ins) {
+				code.push_back(ins);
+				return code.size() - 1;
+			}
+
+			int binary(PatchProgram::Op op, int a, int b, Time offset) {
+				PatchProgram::Instruction ins = blank(op, offset);
+				ins.a = a;
+				ins.b = b;
+				ins.active = op == PatchProgram::OP_ADD ?
+					code[a].active.hull(code[b].active) : code[a].active.intersect(code[b].active);
+				return push(ins);
+			}
+
+			int window(int a, Time from, Time to, Time offset) {
+				PatchProgram::Instruction ins = blank(PatchProgram::OP_WINDOW, offset);
+				ins.a = a;
+				ins.from = from;
+				ins.to = to;
+				ins.active = code[a].active.intersect(TimeRange::between(from, to));
+				return push(ins);
+			}
+
+			int emit(int id, Time offset) {
+				auto key = std::make_pair(id, offset);
+				auto found = emitted.find(key);
+				if (found != emitted.end())
+					return found->second;
+
+				const PatchNode& node = graph.nodes[id];
+				int value;
+				switch (node.kind) {
+				case PatchNode::SIN: {
+					PatchProgram::Instruction ins = blank(PatchProgram::OP_SIN, offset);
+					ins.value = node.value;
+					value = push(ins);
+					break;
+				}
+				case PatchNode::CONST: {
+					PatchProgram::Instruction ins = blank(PatchProgram::OP_CONST, offset);
+					ins.value = node.value;
+					ins.active = node.value == 0 ? TimeRange::never() : TimeRange::always();
+					value = push(ins);
+					break;
+				}
+				case PatchNode::ADD:
+				case PatchNode::MUL: {
+					PatchProgram::Op op = node.kind == PatchNode::ADD ? PatchProgram::OP_ADD : PatchProgram::OP_MUL;
+					value = emit(node.inputs[0], offset);
+					for (size_t i = 1; i < node.inputs.size(); ++i)
+						value = binary(op, value, emit(node.inputs[i], offset), offset);
+					break;
+				}
+				case PatchNode::SHIFT:
+					value = window(emit(node.inputs[0], offset + node.time), offset + node.time, FOREVER, offset);
+					break;
+				case PatchNode::WINDOW:
+					value = window(emit(node.inputs[0], offset), offset, offset + node.time, offset);
+					break;
+				case PatchNode::ENVELOPE: {
+					PatchProgram::Instruction ins = blank(PatchProgram::OP_ENVELOPE, offset);
+					ins.a = emit(node.inputs[0], offset);
+					ins.gain = AdsrGain(node.shape, node.time);
+					ins.active = code[ins.a].active.intersect(TimeRange(0, node.time).shifted(offset));
+					value = push(ins);
+					break;
+				}
+				default:
+					throw std::runtime_error("unknown patch node");
+				}
+				emitted[key] = value;
+				return value;
+			}
+		};
+	}
+
+	PatchProgram PatchProgram::compile(const PatchGraph& graph) {
+		if (graph.output < 0 || graph.output >= (int) graph.nodes.size())
+			throw std::runtime_error("patch has no output");
+
+		Lowering lowering(graph);
+		int result = lowering.emit(graph.output, 0);
+		std::vector<Instruction>& code = lowering.code;
+
+		// an instruction only has to run while something reading it is audible, so
+		// the range in which each value is needed is pushed down from the output.
+		// this is what lets the oscillators of a note that is windowed out sleep.
+		std::vector<TimeRange> needed(code.size(), TimeRange::never());
+		needed[result] = TimeRange::always();
+		for (int i = code.size() - 1; i >= 0; --i) {
+			Instruction& ins = code[i];
+			ins.active = ins.active.intersect(needed[i]);
+			TimeRange need = ins.active;
+			if (ins.op == OP_WINDOW)
+				need = need.intersect(TimeRange::between(ins.from, ins.to));
+			if (ins.a >= 0)
+				needed[ins.a] = needed[ins.a].hull(need);
+			if (ins.b >= 0)
+				needed[ins.b] = needed[ins.b].hull(need);
+		}
+
+		// peak amplitude, before a and b are turned into registers
+		std::vector<float> peak(code.size());
+		for (size_t i = 0; i < code.size(); ++i) {
+			const Instruction& ins = code[i];
+			switch (ins.op) {
+			case OP_SIN: peak[i] = 1; break;
+			case OP_CONST: peak[i] = std::fabs(ins.value); break;
+			case OP_ADD: peak[i] = peak[ins.a] + peak[ins.b]; break;
+			case OP_MUL: peak[i] = peak[ins.a] * peak[ins.b]; break;
+			default: peak[i] = peak[ins.a]; break;
+			}
+		}
+
+		// register allocation
+		std::vector<int> lastUse(code.size(), -1);
+		for (size_t i = 0; i < code.size(); ++i) {
+			if (code[i].a >= 0)
+				lastUse[code[i].a] = i;
+			if (code[i].b >= 0)
+				lastUse[code[i].b] = i;
+		}
+		lastUse[result] = code.size();
+
+		std::vector<int> registerOf(code.size(), -1);
+		std::vector<int> free;
+		int registerCount = 0;
+		for (size_t i = 0; i < code.size(); ++i) {
+			Instruction& ins = code[i];
+			int a = ins.a, b = ins.b;
+			if (a >= 0)
+				ins.a = registerOf[a];
+			if (b >= 0)
+				ins.b = registerOf[b];
+			// inputs read for the last time can be overwritten by this instruction's output
+			if (a >= 0 && lastUse[a] == (int) i)
+				free.push_back(registerOf[a]);
+			if (b >= 0 && b != a && lastUse[b] == (int) i)
+				free.push_back(registerOf[b]);
+			if (free.empty()) {
+				registerOf[i] = registerCount++;
+			} else {
+				registerOf[i] = free.back();
+				free.pop_back();
+			}
+			ins.out = registerOf[i];
+			if (lastUse[i] < 0)
+				free.push_back(ins.out); // never read, e.g. dead code behind a shared node
+		}
+
+		PatchProgram program;
+		program.code = std::make_shared<const std::vector<Instruction>>(std::move(code));
+		program.registerCount = registerCount;
+		program.outputRegister = registerOf[result];
+		program.active = (*program.code)[result].active;
+		program.peak = peak[result];
+		program.registers.resize(registerCount * BLOCK_SIZE);
+		program.silent.resize(registerCount);
+		return program;
+	}
+
+	/*
+		running
+	*/
+	PatchProgram::PatchProgram(const PatchProgram& other) {
+		*this = other;
+	}
+
+	PatchProgram& PatchProgram::operator = (const PatchProgram& other) {
+		code = other.code;
+		registerCount = other.registerCount;
+		outputRegister = other.outputRegister;
+		active = other.active;
+		peak = other.peak;
+		registers.assign(registerCount * BLOCK_SIZE, 0.0f);
+		silent.assign(registerCount, 0);
+		return *this;
+	}
+
+	void PatchProgram::render(Time time, float* out, int frames) {
+		if (!code) {
+			std::fill(out, out + frames, 0.0f);
+			return;
+		}
+		for (int done = 0; done < frames; done += BLOCK_SIZE) {
+			int n = std::min(BLOCK_SIZE, frames - done);
+			run(time + done, n);
+			if (silent[outputRegister])
+				std::fill(out + done, out + done + n, 0.0f);
+			else
+				std::copy(reg(outputRegister), reg(outputRegister) + n, out + done);
+		}
+	}
+
+	void PatchProgram::run(Time time, int frames) {
+		for (const Instruction& ins : *code) {
+			if (!ins.active.overlaps(time, frames)) {
+				silent[ins.out] = 1;
+				continue;
+			}
+
+			float* out = reg(ins.out);
+			switch (ins.op) {
+			case OP_SIN: {
+				double cycles = ((double) (time - ins.offset)) / ins.value;
+				dsp::sinBlock(out, frames, cycles - floor(cycles), 1.0 / ins.value);
+				break;
+			}
+			case OP_CONST:
+				std::fill(out, out + frames, ins.value);
+				break;
+			case OP_ADD: {
+				bool silentA = silent[ins.a], silentB = silent[ins.b];
+				const float* a = reg(ins.a);
+				const float* b = reg(ins.b);
+				if (silentA && silentB) {
+					silent[ins.out] = 1;
+					continue;
+				} else if (silentA || silentB) {
+					const float* from = silentA ? b : a;
+					if (from != out)
+						std::copy(from, from + frames, out);
+				} else {
+					for (int i = 0; i < frames; ++i)
+						out[i] = a[i] + b[i];
+				}
+				break;
+			}
+			case OP_MUL: {
+				if (silent[ins.a] || silent[ins.b]) {
+					silent[ins.out] = 1;
+					continue;
+				}
+				const float* a = reg(ins.a);
+				const float* b = reg(ins.b);
+				for (int i = 0; i < frames; ++i)
+					out[i] = a[i] * b[i];
+				break;
+			}
+			case OP_WINDOW: {
+				if (silent[ins.a]) {
+					silent[ins.out] = 1;
+					continue;
+				}
+				const float* a = reg(ins.a);
+				int first = std::max(0, std::min(frames, ins.from - time));
+				int last = std::max(first, std::min(frames, ins.to == FOREVER ? frames : ins.to - time));
+				std::fill(out, out + first, 0.0f);
+				if (a != out)
+					std::copy(a + first, a + last, out + first);
+				std::fill(out + last, out + frames, 0.0f);
+				break;
+			}
+			case OP_ENVELOPE: {
+				if (silent[ins.a]) {
+					silent[ins.out] = 1;
+					continue;
+				}
+				ScratchBlock gain;
+				ins.gain.render(time - ins.offset, gain.data, frames);
+				if (out != reg(ins.a))
+					std::copy(reg(ins.a), reg(ins.a) + frames, out);
+				dsp::mulBlock(out, gain.data, frames);
+				break;
+			}
+			}
+			silent[ins.out] = 0;
+		}
+	}
+
+}
@@ -0,0 +1,170 @@
+#ifndef __PATCH_H_
+#define __PATCH_H_
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "synth2.h"
+
+namespace synth {
+
+	/*
+		RUNTIME PATCHES
+		the templates in synth2.h need every patch to be known at compile time.
+		a PatchGraph describes a patch at runtime instead, either built in code or
+		parsed from text, and PatchProgram lowers it to a flat list of block
+		operations over a fixed set of registers which a single loop runs.
+
+		text format, one statement per line, # starts a comment, times are in seconds:
+			osc = sin 440           # sine at 440hz
+			amp = const 0.5
+			tone = mul osc amp      # add / mul take two or more inputs
+			note = window tone 0.25 # silence after 0.25s
+			late = shift note 1.5   # start 1.5s later
+			soft = envelope late 0.01 0.05 0.7 0.1 0.25 exponential
+			                        # attack, decay, sustain, release, length, [linear|exponential]
+			output soft
+	*/
+	struct PatchNode {
+		enum Kind { SIN, CONST, ADD, MUL, SHIFT, WINDOW, ENVELOPE };
+
+		Kind kind;
+		std::vector<int> inputs;
+		float value;  // SIN: period in samples, CONST: the value
+		Time time;    // SHIFT: amount, WINDOW: duration, ENVELOPE: length
+		Adsr shape;   // ENVELOPE
+	};
+
+	class PatchGraph {
+	private:
+		int addNode(PatchNode::Kind kind, std::vector<int> inputs);
+
+	public:
+		std::vector<PatchNode> nodes;
+		int output; // the node the patch plays, the last node added unless set
+
+		PatchGraph() : output(-1) { };
+
+		// each of these adds a node and returns its id
+		int sin(float period);
+		int constant(float value);
+		int add(const std::vector<int>& inputs);
+		int mul(const std::vector<int>& inputs);
+		int shift(int input, Time amount);
+		int window(int input, Time duration);
+		int envelope(int input, const Adsr& shape, Time length);
+
+		// throws std::runtime_error describing the first bad line
+		static PatchGraph parse(std::istream& in);
+		static PatchGraph load(const char* fname);
+	};
+
+	class PatchProgram {
+	public:
+		enum Op { OP_SIN, OP_CONST, OP_ADD, OP_MUL, OP_WINDOW, OP_ENVELOPE };
+
+		struct Instruction {
+			Op op;
+			int out, a, b;     // registers
+			TimeRange active;  // the block is skipped and out marked silent outside of this
+			Time offset;       // start of the local time line of the node, in program time
+			float value;       // SIN: period, CONST: value
+			Time from, to;     // WINDOW: the audible range in program time
+			AdsrGain gain;     // ENVELOPE, in local time
+		};
+
+	private:
+		std::shared_ptr<const std::vector<Instruction>> code;
+		int registerCount;
+		int outputRegister;
+		TimeRange active;
+		float peak;
+
+		// per instance, so copies of a program can run on different threads
+		std::vector<float> registers;
+		std::vector<char> silent;
+
+		float* reg(int index) {
+			return &registers[index * BLOCK_SIZE];
+		}
+
+		void run(Time time, int frames);
+
+	public:
+		PatchProgram() : registerCount(0), outputRegister(-1), active(TimeRange::never()), peak(0) { };
+		PatchProgram(const PatchProgram& other);
+		PatchProgram& operator = (const PatchProgram& other);
+
+		static PatchProgram compile(const PatchGraph& graph);
+
+		void render(Time time, float* out, int frames);
+
+		TimeRange activeRange() const {
+			return active;
+		}
+
+		float maxAmp() const {
+			return peak;
+		}
+
+		size_t size() const {
+			return code ? code->size() : 0;
+		}
+
+		int registersUsed() const {
+			return registerCount;
+		}
+	};
+
+	// a compiled patch as a SoundSource so it can be mixed with template sources and rendered
+	// usage: auto patch = Patch(PatchProgram::compile(PatchGraph::load("patch.txt")));
+	struct Patch : public SoundSource<Patch> {
+		PatchProgram program;
+
+		Patch() { };
+		Patch(const PatchProgram& program) : program(program) { };
+		Patch(const Patch& other) : program(other.program) { };
+
+		float _maxAmp() const {
+			return program.maxAmp();
+		}
+
+		// rendering writes the program's registers, so one patch can not be rendered by two threads at once
+		bool _stateless() const {
+			return false;
+		}
+
+		TimeRange _activeRange() const {
+			return program.activeRange();
+		}
+
+		// a patch with an output that never ends has to be wrapped with finiteOf before rendering
+		float getDuration() const {
+			return program.activeRange().end();
+		}
+
+		float _sample(const Context& context) {
+			float value;
+			program.render(context.time, &value, 1);
+			return value;
+		}
+
+		void _render(const Context& context, float* out, int frames) {
+			program.render(context.time, out, frames);
+		}
+
+		std::string _toString() const {
+			std::stringstream ss;
+			ss << "Patch(" << program.size() << " instructions)";
+			return ss.str();
+		}
+
+		void inherit(const Patch& other) {
+			program = other.program;
+		}
+	};
+
+};
+
+#endif
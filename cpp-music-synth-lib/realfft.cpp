@@ -0,0 +1,151 @@
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "realfft.h"
+
+namespace synth {
+
+	/*
+		plans
+		the tables are worked out in double and stored in float.
+	*/
+	RealFFT::RealFFT(int size) : n(size), half(size / 2) {
+		if (size < 4 || (size & (size - 1)) != 0)
+			throw std::runtime_error("a real fft needs a power of two size of at least 4, not " + std::to_string(size));
+
+		int bits = 0;
+		while ((1 << bits) < half)
+			++bits;
+		for (int i = 0; i < half; ++i) {
+			int reversed = 0;
+			for (int b = 0; b < bits; ++b)
+				reversed |= ((i >> b) & 1) << (bits - 1 - b);
+			if (i < reversed) {
+				swaps.push_back(i);
+				swaps.push_back(reversed);
+			}
+		}
+
+		const double pi = 3.14159265358979323846;
+		for (int m = 1; m < half; m *= 2) {
+			for (int k = 0; k < m; ++k) {
+				levelRe.push_back((float) std::cos(pi * k / m));
+				levelIm.push_back((float) -std::sin(pi * k / m));
+			}
+		}
+		for (int k = 0; k <= half / 2; ++k) {
+			splitRe.push_back((float) std::cos(2 * pi * k / n));
+			splitIm.push_back((float) -std::sin(2 * pi * k / n));
+		}
+	}
+
+	std::shared_ptr<const RealFFT> RealFFT::get(int size) {
+		static std::map<int, std::shared_ptr<const RealFFT>> plans;
+		static std::mutex lock;
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = plans.find(size);
+		if (found != plans.end())
+			return found->second;
+		std::shared_ptr<const RealFFT> plan(new RealFFT(size));
+		plans.emplace(size, plan);
+		return plan;
+	}
+
+	/*
+		complex transform
+		decimation in time: after the bit reversal every level joins pairs of
+		transforms of m points into transforms of 2m points. the butterflies of
+		one group run over consecutive k, so the inner loop vectorizes.
+	*/
+	void RealFFT::transform(float* re, float* im) const {
+		for (size_t s = 0; s < swaps.size(); s += 2) {
+			std::swap(re[swaps[s]], re[swaps[s + 1]]);
+			std::swap(im[swaps[s]], im[swaps[s + 1]]);
+		}
+		for (int m = 1; m < half; m *= 2) {
+			const float* wr = levelRe.data() + m - 1;
+			const float* wi = levelIm.data() + m - 1;
+			for (int group = 0; group < half; group += 2 * m) {
+				float* ar = re + group;
+				float* ai = im + group;
+				float* br = ar + m;
+				float* bi = ai + m;
+				for (int k = 0; k < m; ++k) {
+					float tr = br[k] * wr[k] - bi[k] * wi[k];
+					float ti = br[k] * wi[k] + bi[k] * wr[k];
+					br[k] = ar[k] - tr;
+					bi[k] = ai[k] - ti;
+					ar[k] += tr;
+					ai[k] += ti;
+				}
+			}
+		}
+	}
+
+	/*
+		real transforms
+		with z = even + i odd and Z its transform, the even and odd halves are
+		E[k] = (Z[k] + conj Z[half - k]) / 2 and O[k] = -i (Z[k] - conj Z[half - k]) / 2,
+		and then X[k] = E[k] + w^k O[k] and X[half - k] = conj(E[k] - w^k O[k])
+		with w = omega(n, -1). bins k and half - k are worked out together, in place.
+	*/
+	void RealFFT::forward(const float* in, float* re, float* im) const {
+		for (int k = 0; k < half; ++k) {
+			re[k] = in[2 * k];
+			im[k] = in[2 * k + 1];
+		}
+		transform(re, im);
+
+		float zr = re[0], zi = im[0];
+		re[0] = zr + zi;
+		im[0] = 0;
+		re[half] = zr - zi;
+		im[half] = 0;
+		for (int k = 1; k <= half / 2; ++k) {
+			int mirror = half - k;
+			float er = 0.5f * (re[k] + re[mirror]), ei = 0.5f * (im[k] - im[mirror]);
+			float or_ = 0.5f * (im[k] + im[mirror]), oi = -0.5f * (re[k] - re[mirror]);
+			float tr = splitRe[k] * or_ - splitIm[k] * oi;
+			float ti = splitRe[k] * oi + splitIm[k] * or_;
+			re[k] = er + tr;
+			im[k] = ei + ti;
+			re[mirror] = er - tr;
+			im[mirror] = ti - ei;
+		}
+	}
+
+	/*
+		the other way round: E[k] = (X[k] + conj X[half - k]) / 2,
+		O[k] = (X[k] - conj X[half - k]) conj(w^k) / 2 and Z[k] = E[k] + i O[k].
+		the inverse complex transform is the forward one with re and im swapped,
+		the halves and the division by half are folded into one scale of 1 / n.
+	*/
+	void RealFFT::inverse(float* re, float* im, float* out) const {
+		const float scale = 1.0f / n;
+		float xr = re[0], yr = re[half];
+		re[0] = scale * (xr + yr);
+		im[0] = scale * (xr - yr);
+		for (int k = 1; k <= half / 2; ++k) {
+			int mirror = half - k;
+			float er = re[k] + re[mirror], ei = im[k] - im[mirror];
+			float dr = re[k] - re[mirror], di = im[k] + im[mirror];
+			// times conj(w^k)
+			float or_ = dr * splitRe[k] + di * splitIm[k];
+			float oi = di * splitRe[k] - dr * splitIm[k];
+			re[k] = scale * (er - oi);
+			im[k] = scale * (ei + or_);
+			re[mirror] = scale * (er + oi);
+			im[mirror] = scale * (or_ - ei);
+		}
+		transform(im, re);
+
+		for (int k = 0; k < half; ++k) {
+			out[2 * k] = re[k];
+			out[2 * k + 1] = im[k];
+		}
+	}
+
+};
@@ -0,0 +1,75 @@
+#ifndef __REALFFT_H_
+#define __REALFFT_H_
+
+#include <memory>
+#include <vector>
+
+namespace synth {
+
+	/*
+		REAL FFTS
+		the transform of size real samples, power of two sizes of at least 4.
+		the size / 2 + 1 bins up to nyquist are the whole spectrum of a real
+		signal, the rest are their complex conjugates, so only those are
+		computed: the samples are packed into a complex signal of half the size
+		(even samples as real parts, odd samples as imaginary parts), transformed
+		with an iterative radix 2 fft and split apart afterwards.
+
+		bins are split arrays, the real parts in one and the imaginary parts in
+		another, so they can be fed straight to dsp::complexMulAdd. the arrays
+		are also the working memory of the transform, so a transform allocates
+		nothing. a plan only holds its tables and is never changed after it is
+		made, so plans are shared between threads.
+
+		the visualizer's FFTPlan and SplitFFT do the same for complex input, but
+		they belong to another program: global namespace, their own global pi
+		(ambiguous with synth::pi wherever the library is used with using
+		namespace synth) and no place in this makefile. so the library keeps
+		this small transform of its own, with the packing of real input the
+		convolver needs built in.
+
+		usage:
+			std::shared_ptr<const RealFFT> fft = RealFFT::get(1024);
+			std::vector<float> re(fft->bins()), im(fft->bins());
+			fft->forward(samples, re.data(), im.data());
+			fft->inverse(re.data(), im.data(), samples); // divides by size(), overwrites re and im
+	*/
+	class RealFFT {
+	private:
+		int n;
+		int half; // the size of the complex transform
+		std::vector<int> swaps; // index pairs exchanged to put the input in bit reversed order
+		// omega(2m, -k) for k < m of every level with m butterflies per group, level m starts at m - 1
+		std::vector<float> levelRe, levelIm;
+		// omega(n, -k) for k <= half / 2, to split the half size transform into the real one
+		std::vector<float> splitRe, splitIm;
+
+		explicit RealFFT(int size);
+
+		// the unscaled forward transform of the half size complex signal, in place
+		void transform(float* re, float* im) const;
+
+	public:
+		// the plan for size, made on first use and shared from then on
+		static std::shared_ptr<const RealFFT> get(int size);
+
+		int size() const {
+			return n;
+		}
+
+		// the values of each of the re and im arrays
+		int bins() const {
+			return half + 1;
+		}
+
+		// bins of in[0, size())
+		void forward(const float* in, float* re, float* im) const;
+
+		// the samples with the given bins, divided by size() so inverse(forward(x)) = x.
+		// re and im are used as working memory and left overwritten
+		void inverse(float* re, float* im, float* out) const;
+	};
+
+};
+
+#endif
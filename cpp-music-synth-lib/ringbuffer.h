@@ -0,0 +1,88 @@
+#ifndef __RINGBUFFER_H_
+#define __RINGBUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace synth {
+
+	/*
+		a fixed capacity queue for exactly one producer thread and one consumer
+		thread. neither side ever takes a lock: the producer fills the slot at
+		back() and publishes it with push(), the consumer reads slots with peek()
+		and hands them back with pop(). positions only ever grow, the slot of a
+		position is position % capacity.
+
+		usage:
+			producer: while (!(slot = ring.back())) wait; *slot = ...; ring.push();
+			consumer: for (size_t i = 0; i < ring.available(); ++i) use(*ring.peek(i)); ring.pop(n);
+	*/
+	template<class T>
+	class SpscRing {
+	private:
+		std::unique_ptr<T[]> items;
+		size_t slots;
+
+		// on separate cache lines so the two threads do not keep stealing each other's line
+		alignas(64) std::atomic<size_t> head; // next position to read, only written by the consumer
+		alignas(64) std::atomic<size_t> tail; // next position to write, only written by the producer
+
+	public:
+		SpscRing(size_t capacity) : items(new T[capacity]), slots(capacity), head(0), tail(0) { };
+
+		SpscRing(const SpscRing&) = delete;
+		SpscRing& operator = (const SpscRing&) = delete;
+
+		size_t capacity() const {
+			return slots;
+		}
+
+		// published slots not yet popped, exact on either thread for its own side
+		size_t size() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		}
+
+		/*
+			producer side
+		*/
+		size_t writePosition() const {
+			return tail.load(std::memory_order_relaxed);
+		}
+
+		// the slot to fill next, nullptr while the ring is full
+		T* back() {
+			size_t position = tail.load(std::memory_order_relaxed);
+			if (position - head.load(std::memory_order_acquire) == slots)
+				return nullptr;
+			return &items[position % slots];
+		}
+
+		void push() {
+			tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/*
+			consumer side
+		*/
+		size_t readPosition() const {
+			return head.load(std::memory_order_relaxed);
+		}
+
+		size_t available() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+		}
+
+		// the i-th published slot, i < available()
+		T* peek(size_t i) {
+			return &items[(head.load(std::memory_order_relaxed) + i) % slots];
+		}
+
+		void pop(size_t count = 1) {
+			head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+		}
+	};
+
+};
+
+#endif
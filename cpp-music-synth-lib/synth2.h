@@ -8,12 +8,24 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <new>
+#include <cstddef>
+
+#include "dsp.h"
+#include "arena.h"
 
 namespace synth {
 
 const int SAMPLES_PER_SECOND = 44100;
+const int BLOCK_SIZE = 256; // frames rendered per call when walking a tree a block at a time
 const float pi = 3.141592653589;
 typedef int Time;
+const Time FOREVER = std::numeric_limits<Time>::max();
+const int HISTORY_FRAMES = 1 << 16; // default length of the output history, about 1.5 seconds
 
 /*
 	ABSTRACTING THE CONCEPT OF TIMING
@@ -36,6 +48,7 @@ struct TimeRange {
 	Time offset;
 	Time duration;
 
+	TimeRange() : offset(0), duration(0) { };
 	TimeRange(Time offset, Time duration) : offset(offset), duration(duration) { };
 
 	int getOffset() {
@@ -45,6 +58,53 @@ struct TimeRange {
 	int getDuration() {
 		return duration;
 	}
+
+	// a range that never ends, for sources that can sound at any time
+	static TimeRange always() {
+		return TimeRange(0, FOREVER);
+	}
+
+	static TimeRange never() {
+		return TimeRange(0, 0);
+	}
+
+	static TimeRange between(Time start, Time end) {
+		return TimeRange(start, end == FOREVER ? FOREVER : end - start);
+	}
+
+	bool empty() const {
+		return duration <= 0;
+	}
+
+	Time end() const {
+		return duration >= FOREVER - offset ? FOREVER : offset + duration;
+	}
+
+	// does [from, from + frames) touch this range
+	bool overlaps(Time from, int frames) const {
+		return !empty() && from < end() && from + frames > offset;
+	}
+
+	TimeRange shifted(Time by) const {
+		if (empty())
+			return *this;
+		return between(offset + by, end() == FOREVER ? FOREVER : end() + by);
+	}
+
+	TimeRange intersect(const TimeRange& other) const {
+		Time start = std::max(offset, other.offset);
+		Time stop = std::min(end(), other.end());
+		return stop > start ? between(start, stop) : never();
+	}
+
+	// smallest range covering both
+	TimeRange hull(const TimeRange& other) const {
+		if (empty())
+			return other;
+		if (other.empty())
+			return *this;
+		return between(std::min(offset, other.offset), std::max(end(), other.end()));
+	}
 };
 
 inline extern TimeRange operator + (TimeRange& a, TimeRange& b) {
@@ -52,22 +112,126 @@ inline extern TimeRange operator + (TimeRange& a, TimeRange& b) {
 }
 
 
+/*
+	HISTORY
+	the most recent output of a render, for nodes that feed back on what has
+	already been played (delays, comb filters). it is a ring of a power of two
+	frames, anything older has been overwritten, so render memory does not grow
+	with the length of the song. the renderers append every block once it has
+	been rendered, a block can see everything before its own start.
+	usage: History history(seconds(1)); ... history.append(block, frames);
+*/
+class History {
+private:
+	std::vector<float> ring;
+	size_t mask;
+	Time end; // one past the newest frame
+
+public:
+	History(size_t frames = HISTORY_FRAMES) : end(0) {
+		size_t capacity = 1;
+		while (capacity < frames)
+			capacity <<= 1;
+		ring.assign(capacity, 0.0f);
+		mask = capacity - 1;
+	}
+
+	size_t capacity() const {
+		return ring.size();
+	}
+
+	// the output at time, 0 if it has not been rendered yet or is no longer held
+	float at(Time time) const {
+		if (time < 0 || time >= end || end - time > (Time) ring.size())
+			return 0;
+		return ring[time & mask];
+	}
+
+	// adds the frames following the newest one
+	void append(const float* samples, int frames) {
+		for (int i = 0; i < frames; ++i)
+			ring[(end + i) & mask] = samples[i];
+		end += frames;
+	}
+};
+
 /*
 	SOUND SOURCE
 */
 struct Context {
 	int time;
 	int duration;
-	float* samples;
-	Context(int time, int duration, float* samples) : time(time), duration(duration), samples(samples) { };
+	// the output rendered so far, nullptr when there is none to look at, e.g. when
+	// rendering in parallel. nodes reading it are not stateless
+	const History* history;
+	Time historyOffset; // time + historyOffset is the time of the history
+
+	Context(int time, int duration, const History* history = nullptr, Time historyOffset = 0)
+		: time(time), duration(duration), history(history), historyOffset(historyOffset) { };
+
+	// the output at local time t
+	float past(Time t) const {
+		return history ? history->at(t + historyOffset) : 0;
+	}
+};
+
+/*
+	SCRATCH BUFFERS
+	nodes that combine several children need somewhere to render the extra
+	children to. rather than every node owning its own buffers, blocks of
+	BLOCK_SIZE floats are handed out in stack order from a per thread pool as
+	the tree is walked, so the same few blocks get reused by every node.
+	usage: ScratchBlock tmp; child.render(context, tmp.data, n);
+*/
+class ScratchBlock {
+	static std::vector<std::unique_ptr<float[]>>& pool() {
+		static thread_local std::vector<std::unique_ptr<float[]>> blocks;
+		return blocks;
+	}
+
+	static size_t& depth() {
+		static thread_local size_t inUse = 0;
+		return inUse;
+	}
+
+public:
+	float* data;
+
+	ScratchBlock() {
+		auto& blocks = pool();
+		size_t& used = depth();
+		if (used == blocks.size())
+			blocks.emplace_back(new float[BLOCK_SIZE]);
+		data = blocks[used++].get();
+	}
+
+	~ScratchBlock() {
+		--depth();
+	}
+
+	ScratchBlock(const ScratchBlock&) = delete;
+	ScratchBlock& operator = (const ScratchBlock&) = delete;
 };
 
 
 struct SoundSourceBase {
 	virtual ~SoundSourceBase() { };
 	virtual float sample(const Context& context) = 0;
+	// fills out[0..frames) with the samples at context.time, context.time + 1, ...
+	virtual void render(const Context& context, float* out, int frames) = 0;
 	virtual float maxAmp() const = 0;
+	// true if every sample depends only on context.time, so disjoint time ranges
+	// can be rendered independently (and concurrently) without changing the result
+	virtual bool stateless() const = 0;
+	// the times at which the source may be non-zero. it is silent everywhere else,
+	// so nodes combining sources can skip rendering children that are out of range
+	virtual TimeRange activeRange() const = 0;
 	virtual SoundSourceBase* dynamicCopy() const = 0;
+	// placement copy / move into caller provided storage, nullptr if it needs more than capacity bytes
+	virtual SoundSourceBase* copyInto(void* storage, size_t capacity) const = 0;
+	virtual SoundSourceBase* moveInto(void* storage, size_t capacity) = 0;
+	// bytes of storage copyInto needs
+	virtual size_t footprint() const = 0;
 	virtual std::string toString() const = 0;
 };
 
@@ -98,6 +262,19 @@ struct SoundSource : public SoundSourceBase {
 	float _sample(const Context& context) {
 		return 0;
 	}
+
+	void render(const Context& context, float* out, int frames) {
+		get_ref()._render(context, out, frames);
+	}
+
+	// fallback for classes without a block implementation: sample every frame individually
+	void _render(const Context& context, float* out, int frames) {
+		Context c(context);
+		for (int i = 0; i < frames; ++i) {
+			c.time = context.time + i;
+			out[i] = get_ref()._sample(c);
+		}
+	}
 	
 	float maxAmp() const {
 		return get_ref()._maxAmp();
@@ -107,6 +284,23 @@ struct SoundSource : public SoundSourceBase {
 		return 0;
 	}
 
+	bool stateless() const {
+		return get_ref()._stateless();
+	}
+
+	// sources that carry state from one sample to the next must override this to return false
+	bool _stateless() const {
+		return true;
+	}
+
+	TimeRange activeRange() const {
+		return get_ref()._activeRange();
+	}
+
+	TimeRange _activeRange() const {
+		return TimeRange::always();
+	}
+
 	// assignment operator using the inherit method that all derived classes must implement
 	template<typename T>
 	Derived& operator = (const SoundSource<T>& other) {
@@ -119,6 +313,22 @@ struct SoundSource : public SoundSourceBase {
 		return new Derived(get_ref());
 	}
 
+	SoundSourceBase* copyInto(void* storage, size_t capacity) const {
+		if (sizeof(Derived) > capacity || alignof(Derived) > alignof(std::max_align_t))
+			return nullptr;
+		return new (storage) Derived(get_ref());
+	}
+
+	SoundSourceBase* moveInto(void* storage, size_t capacity) {
+		if (sizeof(Derived) > capacity || alignof(Derived) > alignof(std::max_align_t))
+			return nullptr;
+		return new (storage) Derived(std::move(get_ref()));
+	}
+
+	size_t footprint() const {
+		return sizeof(Derived);
+	}
+
 	std::string toString() const {
 		return dynamic_cast<const Derived&>(*this)._toString();
 	}
@@ -135,11 +345,21 @@ struct SinWave : public SoundSource<SinWave> {
 		*this = parent;
 	}
 	
+	// position within the current cycle, in [0, 1)
+	double phaseAt(Time time) const {
+		double cycles = ((double) time) / period;
+		return cycles - floor(cycles);
+	}
+
 	float _sample(const Context& context) {
-		return sin(2.0 * pi * ((float) context.time) / period);
+		return sin(2.0 * M_PI * phaseAt(context.time));
 	}
 
-	constexpr float _maxAmp() const {
+	void _render(const Context& context, float* out, int frames) {
+		dsp::sinBlock(out, frames, phaseAt(context.time), 1.0 / period);
+	}
+
+	float _maxAmp() const {
 		return 1;
 	}
 
@@ -171,6 +391,14 @@ struct ConstValue : public SoundSource<ConstValue> {
 		return value;
 	}
 
+	void _render(const Context&, float* out, int frames) {
+		std::fill(out, out + frames, value);
+	}
+
+	TimeRange _activeRange() const {
+		return value == 0 ? TimeRange::never() : TimeRange::always();
+	}
+
 	std::string _toString() const {
 		std::stringstream ss;
 		ss << "ConstValue(" << value << ")";
@@ -183,42 +411,170 @@ struct ConstValue : public SoundSource<ConstValue> {
 
 };
 
+class WavFileReader; // fileformats.h
+
+// a recorded sound played back from a wav file
+// the samples are decoded a block at a time straight from the mapped file, so
+// nothing is loaded up front and copies share the mapping. the file is played
+// sample for sample, files at other sample rates are not resampled.
+// usage: SampleSource("test.wav") or SampleSource(reader, channel)
+struct SampleSource : public SoundSource<SampleSource> {
+	std::shared_ptr<const WavFileReader> reader;
+	int channel; // -1 mixes all channels down
+	Time length;
+
+	SampleSource() : channel(-1), length(0) { };
+	SampleSource(const char* fname, int channel = -1);
+	SampleSource(std::shared_ptr<const WavFileReader> reader, int channel = -1);
+	SampleSource(const SampleSource& other) : reader(other.reader), channel(other.channel), length(other.length) { };
+
+	// full scale, finding the real peak would mean reading the whole file
+	float _maxAmp() const {
+		return 1;
+	}
+
+	TimeRange _activeRange() const {
+		return TimeRange(0, length);
+	}
+
+	float getDuration() const {
+		return length;
+	}
+
+	float _sample(const Context& context) {
+		float value;
+		_render(context, &value, 1);
+		return value;
+	}
+
+	void _render(const Context& context, float* out, int frames);
+
+	std::string _toString() const {
+		std::stringstream ss;
+		ss << "SampleSource(" << length << ")";
+		return ss.str();
+	}
+
+	void inherit(const SampleSource& other) {
+		reader = other.reader;
+		channel = other.channel;
+		length = other.length;
+	}
+};
+
 // a Dynamic Sound Source
+// owns a copy of any other source behind a virtual interface. sources of up to
+// INLINE_CAPACITY bytes are stored inside the Dynamic itself, bigger ones go to
+// the RenderArena of the current thread if there is one and to the heap otherwise.
 struct Dynamic : public SoundSource<Dynamic> {
+	static const size_t INLINE_CAPACITY = 64;
+
+	enum Placement { EMPTY, INLINE, ARENA, HEAP };
+
 	SoundSourceBase* base;
+	Placement placement;
+	alignas(std::max_align_t) unsigned char storage[INLINE_CAPACITY];
+
+	Dynamic() : base(nullptr), placement(EMPTY) { };
 
-	Dynamic() { base = nullptr; };
+	Dynamic(const Dynamic& parent) : base(nullptr), placement(EMPTY) {
+		assign(parent.base);
+	}
 
-	Dynamic(const Dynamic& parent) {
-		base = parent.base->dynamicCopy();
+	Dynamic(Dynamic&& parent) : base(nullptr), placement(EMPTY) {
+		take(parent);
 	}
 
 	template<class T>
-	Dynamic(const SoundSource<T>& base) {
-		this->base = base.dynamicCopy();
+	Dynamic(const SoundSource<T>& base) : base(nullptr), placement(EMPTY) {
+		assign(&base);
 	}
 
 	~Dynamic() {
-		// there is a memory leak here!
+		clear();
+	}
+
+	Dynamic& operator = (const Dynamic& other) {
+		if (this != &other)
+			assign(other.base);
+		return *this;
+	}
+
+	Dynamic& operator = (Dynamic&& other) {
+		if (this != &other)
+			take(other);
+		return *this;
+	}
+
+	void clear() {
+		if (placement == HEAP)
+			delete base;
+		else if (placement != EMPTY)
+			base->~SoundSourceBase(); // arena memory is reclaimed with the arena
 		base = nullptr;
+		placement = EMPTY;
+	}
+
+	// replace the held source with a copy of source
+	void assign(const SoundSourceBase* source) {
+		clear();
+		if (source == nullptr)
+			return;
+		if ((base = source->copyInto(storage, INLINE_CAPACITY)) != nullptr) {
+			placement = INLINE;
+		} else if (RenderArena* arena = RenderArena::current()) {
+			size_t bytes = source->footprint();
+			base = source->copyInto(arena->allocate(bytes), bytes);
+			placement = ARENA;
+		}
+		if (base == nullptr) {
+			base = source->dynamicCopy();
+			placement = HEAP;
+		}
+	}
+
+	// steal the source held by other, only inline sources have to be moved
+	void take(Dynamic& other) {
+		clear();
+		if (other.placement == INLINE) {
+			base = other.base->moveInto(storage, INLINE_CAPACITY);
+			placement = INLINE;
+			other.clear();
+		} else {
+			base = other.base;
+			placement = other.placement;
+			other.base = nullptr;
+			other.placement = EMPTY;
+		}
 	}
 
 	float _maxAmp() const {
 		return base->maxAmp();
 	}
 
+	bool _stateless() const {
+		return base->stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return base->activeRange();
+	}
+
 	float _sample(const Context& context) {
 		return base->sample(context);
 	}
 
+	void _render(const Context& context, float* out, int frames) {
+		base->render(context, out, frames);
+	}
+
 	std::string _toString() const {
 		return std::string("Dynamic");
 	}
 
 	void inherit(const Dynamic& other) {
-		if (this->base != nullptr)
-			delete this->base;
-		this->base = other.base->dynamicCopy();
+		if (this != &other)
+			assign(other.base);
 	}
 };
 
@@ -241,10 +597,44 @@ struct WaveAdder : public SoundSource<WaveAdder<T1, T2...>> {
 		return wave1.maxAmp() + wave2.maxAmp();
 	}
 
+	bool _stateless() const {
+		return wave1.stateless() && wave2.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return wave1.activeRange().hull(wave2.activeRange());
+	}
+
 	float _sample(const Context& context) {
 		return wave1.sample(context) + wave2.sample(context);
 	}
 
+	// children that are silent for a whole block are not rendered at all
+	void _render(const Context& context, float* out, int frames) {
+		TimeRange range1 = wave1.activeRange();
+		TimeRange range2 = wave2.activeRange();
+		Context c(context);
+		for (int done = 0; done < frames; done += BLOCK_SIZE) {
+			int n = std::min(BLOCK_SIZE, frames - done);
+			c.time = context.time + done;
+			bool active1 = range1.overlaps(c.time, n);
+			bool active2 = range2.overlaps(c.time, n);
+			if (active1 && active2) {
+				ScratchBlock tmp;
+				wave1.render(c, out + done, n);
+				wave2.render(c, tmp.data, n);
+				for (int i = 0; i < n; ++i)
+					out[done + i] += tmp.data[i];
+			} else if (active1) {
+				wave1.render(c, out + done, n);
+			} else if (active2) {
+				wave2.render(c, out + done, n);
+			} else {
+				std::fill(out + done, out + done + n, 0.0f);
+			}
+		}
+	}
+
 	std::string _toString() const {
 		return std::string("WaveAdder(") + wave1.toString() + ", " + wave2.toString();
 	}
@@ -271,10 +661,22 @@ struct WaveAdder<T1> : public SoundSource<WaveAdder<T1>> {
 		return wave1.maxAmp();
 	}
 
+	bool _stateless() const {
+		return wave1.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return wave1.activeRange();
+	}
+
 	float _sample(const Context& context) {
 		return wave1.sample(context);
 	}
 
+	void _render(const Context& context, float* out, int frames) {
+		wave1.render(context, out, frames);
+	}
+
 	std::string _toString() const {
 		return wave1.toString() + ")";
 	}
@@ -303,10 +705,37 @@ struct WaveMult : public SoundSource<WaveMult<T1, T2...>> {
 		return wave1.maxAmp() * wave2.maxAmp();
 	}
 
+	bool _stateless() const {
+		return wave1.stateless() && wave2.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return wave1.activeRange().intersect(wave2.activeRange());
+	}
+
 	float _sample(const Context& context) {
 		return wave1.sample(context) * wave2.sample(context);
 	}
 
+	// the product is silent wherever either child is
+	void _render(const Context& context, float* out, int frames) {
+		TimeRange range = _activeRange();
+		Context c(context);
+		for (int done = 0; done < frames; done += BLOCK_SIZE) {
+			int n = std::min(BLOCK_SIZE, frames - done);
+			c.time = context.time + done;
+			if (!range.overlaps(c.time, n)) {
+				std::fill(out + done, out + done + n, 0.0f);
+				continue;
+			}
+			ScratchBlock tmp;
+			wave1.render(c, out + done, n);
+			wave2.render(c, tmp.data, n);
+			for (int i = 0; i < n; ++i)
+				out[done + i] *= tmp.data[i];
+		}
+	}
+
 	std::string _toString() const {
 		return std::string("WaveMult(") + wave1.toString() + ", " + wave2.toString();
 	}
@@ -333,10 +762,22 @@ struct WaveMult<T1> : public SoundSource<WaveMult<T1>> {
 		return wave1.maxAmp();
 	}
 
+	bool _stateless() const {
+		return wave1.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return wave1.activeRange();
+	}
+
 	float _sample(const Context& context) {
 		return wave1.sample(context);
 	}
 
+	void _render(const Context& context, float* out, int frames) {
+		wave1.render(context, out, frames);
+	}
+
 	std::string _toString() const {
 		return wave1.toString() + ")";
 	}
@@ -346,30 +787,107 @@ struct WaveMult<T1> : public SoundSource<WaveMult<T1>> {
 	}
 };
 
+// a wave multiplied by a constant gain
+// multiplying by a ConstValue produces one of these (see operator *) so that
+// constants are folded into a single gain when the expression is built
+// usage: scaledOf(wave, 0.5)
+template<class DerivedClass>
+struct Scaled : public SoundSource<Scaled<DerivedClass>> {
+	DerivedClass wave;
+	float gain;
+
+	Scaled() : gain(1) {
+		static_assert(std::is_base_of<SoundSource<DerivedClass>, DerivedClass>::value, "Scaled expects to be provided with a SoundSource.");
+	};
+
+	Scaled(const DerivedClass& wave, float gain) : wave(wave), gain(gain) {
+	}
+
+	float _maxAmp() const {
+		return std::fabs(gain) * wave.maxAmp();
+	}
+
+	bool _stateless() const {
+		return wave.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return gain == 0 ? TimeRange::never() : wave.activeRange();
+	}
+
+	float _sample(const Context& context) {
+		return wave.sample(context) * gain;
+	}
+
+	void _render(const Context& context, float* out, int frames) {
+		wave.render(context, out, frames);
+		for (int i = 0; i < frames; ++i)
+			out[i] *= gain;
+	}
+
+	std::string _toString() const {
+		std::stringstream ss;
+		ss << "Scaled(" << wave.toString() << ", " << gain << ")";
+		return ss.str();
+	}
+
+	void inherit(const Scaled<DerivedClass>& parent) {
+		this->wave = parent.wave;
+		this->gain = parent.gain;
+	}
+};
+
 // Finite range from 0 to x of a sound
 // usage: finiteOf(soundSource, duration)
 template<class DerivedClass>
 struct Finite : public SoundSource<Finite<DerivedClass>> {
 	Time duration;
 	DerivedClass wave;
+	TimeRange active; // cached so that parents can check it once per block in constant time
 	
-	Finite() {
+	Finite() : active(TimeRange::never()) {
 		static_assert(std::is_base_of<SoundSource<DerivedClass>, DerivedClass>::value, "Finite expects to be provided with a SoundSource.");
 	};
 
-	Finite(const DerivedClass& wave, Time duration) : wave(wave), duration(duration) {
+	Finite(const DerivedClass& wave, Time duration) : wave(wave), duration(duration), active(TimeRange::never()) {
+		updateActiveRange();
+	}
+
+	void updateActiveRange() {
+		active = wave.activeRange().intersect(TimeRange(0, duration));
 	}
 
 	float _maxAmp() const {
 		return this->wave.maxAmp();
 	}
 
+	bool _stateless() const {
+		return this->wave.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return active;
+	}
+
 	float _sample(const Context& context) {
 		if (context.time >= duration)
 			return 0;
 		return wave.sample(context);
 	}
 
+	// only the part of the block inside the active range is rendered, the rest is silence
+	void _render(const Context& context, float* out, int frames) {
+		int first = std::max(0, std::min(frames, active.offset - context.time));
+		int last = std::max(first, std::min(frames, active.end() - context.time));
+		std::fill(out, out + first, 0.0f);
+		if (last > first) {
+			Context c(context);
+			c.time = context.time + first;
+			wave.render(c, out + first, last - first);
+		}
+		std::fill(out + last, out + frames, 0.0f);
+	}
+
 	float getDuration() const {
 		return duration;
 	}
@@ -383,6 +901,7 @@ struct Finite : public SoundSource<Finite<DerivedClass>> {
 	void inherit(const Finite<DerivedClass>& parent) {
 		this->duration = parent.duration;
 		this->wave = parent.wave;
+		updateActiveRange();
 	}
 };
 
@@ -392,25 +911,50 @@ template<class DerivedClass>
 struct PhaseShift : public SoundSource<PhaseShift<DerivedClass>> {
 	Time shift;
 	DerivedClass wave;
+	TimeRange active; // cached, see Finite
 	
-	PhaseShift() {
+	PhaseShift() : active(TimeRange::never()) {
 		static_assert(std::is_base_of<SoundSource<DerivedClass>, DerivedClass>::value, "Finite expects to be provided with a SoundSource.");
 	};
 
-	PhaseShift(const DerivedClass& wave, Time shift) : wave(wave), shift(shift) {
+	PhaseShift(const DerivedClass& wave, Time shift) : wave(wave), shift(shift), active(TimeRange::never()) {
+		updateActiveRange();
+	}
+
+	void updateActiveRange() {
+		active = wave.activeRange().shifted(shift);
 	}
 
 	float _maxAmp() const {
 		return this->wave.maxAmp();
 	}
 
+	bool _stateless() const {
+		return this->wave.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return active;
+	}
+
 	float _sample(const Context& context) {
 		if (context.time < shift)
 			return 0;
-		Context c(context.time - shift, context.duration - shift, context.samples + shift);
+		Context c(context.time - shift, context.duration - shift, context.history, context.historyOffset + shift);
 		return wave.sample(c);
 	}
 
+	void _render(const Context& context, float* out, int frames) {
+		int first = std::max(0, std::min(frames, active.offset - context.time));
+		int last = std::max(first, std::min(frames, active.end() - context.time));
+		std::fill(out, out + first, 0.0f);
+		if (last > first) {
+			Context c(context.time + first - shift, context.duration - shift, context.history, context.historyOffset + shift);
+			wave.render(c, out + first, last - first);
+		}
+		std::fill(out + last, out + frames, 0.0f);
+	}
+
 	float getShiftAmount() const {
 		return shift;
 	}
@@ -421,9 +965,10 @@ struct PhaseShift : public SoundSource<PhaseShift<DerivedClass>> {
 		return ss.str();
 	}
 
-	void inherit(const Finite<DerivedClass>& parent) {
+	void inherit(const PhaseShift<DerivedClass>& parent) {
 		this->shift = parent.shift;
 		this->wave = parent.wave;
+		updateActiveRange();
 	}
 };
 
@@ -440,6 +985,11 @@ PhaseShift<T> shiftOf(const SoundSource<T>& parent, Time shift) {
 	return PhaseShift<T>(parent.get_ref(), shift);
 }
 
+template<class T>
+Scaled<T> scaledOf(const SoundSource<T>& parent, float gain) {
+	return Scaled<T>(parent.get_ref(), gain);
+}
+
 template<class... T>
 auto waveMult(T... args) {
 	return WaveMult<T...>(args...);
@@ -457,13 +1007,17 @@ auto dynamicOf(const Finite<T>& wave) {
 
 template<class T>
 auto dynamicOf(const SoundSource<T>& wave) {
-	return Dynamic(wave.get_ref().wave);
+	return Dynamic(wave.get_ref());
 }
 
 
 /*
 	wave addition
 */
+inline ConstValue operator + (const ConstValue& a, const ConstValue& b) {
+	return ConstValue(a.value + b.value);
+}
+
 // infinite
 template<class T1, class T2>
 auto operator + (const Finite<T1>& wave1, const Finite<T2>& wave2) -> Finite<decltype(waveAdd(wave1, wave2))> {
@@ -479,12 +1033,47 @@ WaveAdder<T1, T2> operator + (const SoundSource<T1>& wave1, const SoundSource<T2
 /*
 	wave multiplication
 */
+// constants, folded while the expression is built instead of once per sample
+inline ConstValue operator * (const ConstValue& a, const ConstValue& b) {
+	return ConstValue(a.value * b.value);
+}
+
+template<class T>
+Scaled<T> operator * (const Scaled<T>& wave, const ConstValue& c) {
+	return Scaled<T>(wave.wave, wave.gain * c.value);
+}
+
+template<class T>
+Scaled<T> operator * (const ConstValue& c, const Scaled<T>& wave) {
+	return wave * c;
+}
+
+template<class T>
+Scaled<T> operator * (const SoundSource<T>& wave, const ConstValue& c) {
+	return Scaled<T>(wave.get_ref(), c.value);
+}
+
+template<class T>
+Scaled<T> operator * (const ConstValue& c, const SoundSource<T>& wave) {
+	return Scaled<T>(wave.get_ref(), c.value);
+}
+
+template<class T1, class T2>
+Scaled<WaveMult<T1, T2>> operator * (const Scaled<T1>& wave1, const Scaled<T2>& wave2) {
+	return Scaled<WaveMult<T1, T2>>(WaveMult<T1, T2>(wave1.wave, wave2.wave), wave1.gain * wave2.gain);
+}
+
 // finite
 template<class T1, class T2>
 auto operator * (const Finite<T1>& wave1, const Finite<T2>& wave2) -> Finite<decltype(waveMult(wave1, wave2))> {
 	return finiteOf(waveMult(wave1, wave2), std::min(wave1.getDuration(), wave2.getDuration()));
 }
 
+template<class T>
+auto operator * (const Finite<T>& wave, const ConstValue& c) -> Finite<decltype(wave.wave * c)> {
+	return finiteOf(wave.wave * c, wave.getDuration());
+}
+
 template<class T1, class T2>
 auto operator * (const Finite<T1>& wave1, const SoundSource<T2>& wave2) -> Finite<decltype(wave1.wave * wave2.get_ref())> {
 	return finiteOf(wave1.wave * wave2.get_ref(), wave1.getDuration());
@@ -507,7 +1096,7 @@ auto normalize(const Finite<T>& wave) -> Finite<decltype(normalize(wave.wave))>
 
 
 template<class T>
-WaveMult<T, ConstValue> normalize(const SoundSource<T>& wave) {
+auto normalize(const SoundSource<T>& wave) -> decltype(wave.get_ref() * ConstValue(1)) {
 	return wave.get_ref() * ConstValue(1.0 / wave.maxAmp());
 }
 
@@ -519,6 +1108,209 @@ auto operator << (const Finite<T1>& wave1, const Finite<T2>& wave2) {
 }
 
 
+/*
+	SEQUENCES
+	a << b << c nests one level deeper for every note, so long songs take a
+	long time to compile and every note adds a call per block. a Sequence keeps
+	its notes in a flat list sorted by start time instead, with a tree of the
+	latest end time under every node over that list. a block walks down the
+	tree only where some note still sounds, so it costs the log of the number
+	of notes per sounding note, however long any single note is.
+	all notes share one type, use dynamicOf to mix notes of different types.
+	usage:
+		Sequence<decltype(a)> song;
+		song << a << b << c;       // each note starts where the song currently ends
+		song.add(a, seconds(2));   // or at an explicit time
+*/
+template<class NoteType>
+struct Sequence : public SoundSource<Sequence<NoteType>> {
+	struct Event {
+		Time start;
+		NoteType note;
+		TimeRange active; // relative to start
+	};
+
+	std::vector<Event> events; // sorted by start
+	Time duration;
+	// leaf capacity + i is the end of event i, every other node the latest end below it
+	std::vector<Time> ends;
+	size_t capacity;
+	bool allStateless;
+
+	Sequence() : duration(0), capacity(0), allStateless(true) { };
+
+	// appending at or after the last start is amortized O(log n), earlier starts are inserted in order
+	void add(const NoteType& note, Time start) {
+		Event event = { start, note, note.activeRange() };
+		if (events.empty() || events.back().start <= start) {
+			events.push_back(event);
+			if (events.size() <= capacity)
+				setEnd(events.size() - 1);
+			else
+				rebuildEnds();
+		} else {
+			auto at = std::upper_bound(events.begin(), events.end(), start, [](Time t, const Event& e) {
+				return t < e.start;
+			});
+			events.insert(at, event);
+			rebuildEnds();
+		}
+		duration = std::max(duration, start + (Time) note.getDuration());
+		allStateless = allStateless && note.stateless();
+	}
+
+	Sequence<NoteType>& operator << (const NoteType& note) {
+		add(note, duration);
+		return *this;
+	}
+
+	float getDuration() const {
+		return duration;
+	}
+
+	size_t size() const {
+		return events.size();
+	}
+
+	// the largest sum of maxAmp over notes that sound at the same time
+	float _maxAmp() const {
+		std::vector<std::pair<Time, float>> edges;
+		for (const Event& e : events) {
+			TimeRange r = e.active.shifted(e.start);
+			if (r.empty())
+				continue;
+			float amp = e.note.maxAmp();
+			edges.push_back(std::make_pair(r.offset, amp));
+			if (r.end() != FOREVER)
+				edges.push_back(std::make_pair(r.end(), -amp));
+		}
+		// ends sort before starts at the same time
+		std::sort(edges.begin(), edges.end());
+		float amp = 0, peak = 0;
+		for (auto& edge : edges) {
+			amp += edge.second;
+			peak = std::max(peak, amp);
+		}
+		return peak;
+	}
+
+	bool _stateless() const {
+		return allStateless;
+	}
+
+	TimeRange _activeRange() const {
+		TimeRange range = TimeRange::never();
+		for (const Event& e : events)
+			range = range.hull(e.active.shifted(e.start));
+		return range;
+	}
+
+	float _sample(const Context& context) {
+		float value = 0;
+		renderAdd(context, &value, 1);
+		return value;
+	}
+
+	void _render(const Context& context, float* out, int frames) {
+		std::fill(out, out + frames, 0.0f);
+		Context c(context);
+		for (int done = 0; done < frames; done += BLOCK_SIZE) {
+			c.time = context.time + done;
+			renderAdd(c, out + done, std::min(BLOCK_SIZE, frames - done));
+		}
+	}
+
+	std::string _toString() const {
+		std::stringstream ss;
+		ss << "Sequence(" << events.size() << " notes[" << duration << "])";
+		return ss.str();
+	}
+
+	void inherit(const Sequence<NoteType>& parent) {
+		events = parent.events;
+		duration = parent.duration;
+		ends = parent.ends;
+		capacity = parent.capacity;
+		allStateless = parent.allStateless;
+	}
+
+private:
+	static Time endOf(const Event& e) {
+		return e.active.empty() ? std::numeric_limits<Time>::min() : e.active.shifted(e.start).end();
+	}
+
+	// the leaf of event i and the nodes above it
+	void setEnd(size_t i) {
+		size_t node = capacity + i;
+		ends[node] = endOf(events[i]);
+		for (node /= 2; node > 0; node /= 2)
+			ends[node] = std::max(ends[2 * node], ends[2 * node + 1]);
+	}
+
+	void rebuildEnds() {
+		capacity = 1;
+		while (capacity < events.size())
+			capacity *= 2;
+		ends.assign(2 * capacity, std::numeric_limits<Time>::min());
+		for (size_t i = 0; i < events.size(); ++i)
+			ends[capacity + i] = endOf(events[i]);
+		for (size_t node = capacity - 1; node > 0; --node)
+			ends[node] = std::max(ends[2 * node], ends[2 * node + 1]);
+	}
+
+	// adds every note sounding in [context.time, context.time + frames) into out, frames <= BLOCK_SIZE
+	void renderAdd(const Context& context, float* out, int frames) {
+		Time from = context.time;
+		// notes starting at or after the end of the block are not heard yet
+		size_t upper = std::lower_bound(events.begin(), events.end(), from + frames, [](const Event& e, Time t) {
+			return e.start < t;
+		}) - events.begin();
+		if (upper == 0)
+			return;
+
+		// depth first over the nodes whose latest end is after from, left to right so notes add up in start order
+		struct Node {
+			size_t index;
+			size_t first; // the first event below it
+			size_t span;  // events below it
+		};
+		Node stack[2 * sizeof(size_t) * 8];
+		int depth = 0;
+		stack[depth++] = Node{ 1, 0, capacity };
+		while (depth > 0) {
+			Node node = stack[--depth];
+			if (node.first >= upper || ends[node.index] <= from)
+				continue;
+			if (node.span > 1) {
+				size_t half = node.span / 2;
+				stack[depth++] = Node{ 2 * node.index + 1, node.first + half, half };
+				stack[depth++] = Node{ 2 * node.index, node.first, half };
+				continue;
+			}
+			Event* it = &events[node.first];
+			TimeRange r = it->active.shifted(it->start);
+			if (!r.overlaps(from, frames))
+				continue;
+			int first = std::max(0, r.offset - from);
+			int last = std::min(frames, r.end() - from);
+			ScratchBlock tmp;
+			Context c(from + first - it->start, context.duration - it->start, context.history, context.historyOffset + it->start);
+			it->note.render(c, tmp.data, last - first);
+			for (int i = first; i < last; ++i)
+				out[i] += tmp.data[i - first];
+		}
+	}
+};
+
+template<class T, class... Rest>
+Sequence<T> sequenceOf(const T& first, const Rest&... rest) {
+	Sequence<T> sequence;
+	for (const T& note : { first, rest... })
+		sequence << note;
+	return sequence;
+}
+
+
 /*
 	EFFECTS
 */
@@ -527,14 +1319,134 @@ T abs(T v) {
 	return v < 0 ? -v : v;
 }
 
+/*
+	ADSR ENVELOPES
+	an Adsr describes the shape, AdsrGain precomputes the gain curve of that shape
+	for a note of a given length. the note fades in over attack, falls to the
+	sustain level over decay, and fades out over the release that ends exactly at
+	the end of the note. a note without an end (length FOREVER) never releases.
+	the ramps are tabulated once, rendering a block of gain is a handful of copies.
+*/
+struct Adsr {
+	enum Curve { LINEAR, EXPONENTIAL };
+
+	Time attack;
+	Time decay;
+	float sustain; // level held after the decay, 0 to 1
+	Time release;
+	Curve curve;
+
+	// the default is a 0.1s linear fade in and out
+	Adsr(Time attack = seconds(0.1), Time decay = 0, float sustain = 1, Time release = seconds(0.1), Curve curve = LINEAR)
+		: attack(attack), decay(decay), sustain(sustain), release(release), curve(curve) { };
+
+	// position x in [0, 1] along a rising ramp, exponential ramps move quickly first
+	float ramp(float x) const {
+		if (curve == EXPONENTIAL)
+			return (1 - exp(-5 * x)) / (1 - exp(-5.0f));
+		return x;
+	}
+};
+
+class AdsrGain {
+private:
+	// attack followed by decay, then the release already scaled by the level it starts from
+	std::shared_ptr<const std::vector<float>> rise;
+	std::shared_ptr<const std::vector<float>> fall;
+	Time riseLength;
+	Time releaseStart;
+	Time length;
+	float sustain;
+
+	float beforeRelease(Time t) const {
+		return t < riseLength ? (*rise)[t] : sustain;
+	}
+
+public:
+	AdsrGain() : riseLength(0), releaseStart(FOREVER), length(FOREVER), sustain(1) { };
+
+	// a note shorter than attack + decay + release gets all three shortened in proportion,
+	// so it still rises, decays and is released from the level it reached
+	AdsrGain(const Adsr& shape, Time length) : length(length), sustain(shape.sustain) {
+		Time attack = shape.attack;
+		Time decay = shape.decay;
+		Time release = length == FOREVER ? 0 : shape.release;
+		long long total = (long long) attack + decay + release;
+		if (length != FOREVER && total > length) {
+			attack = (Time) (attack * (long long) length / total);
+			decay = (Time) (decay * (long long) length / total);
+			release = (Time) (release * (long long) length / total);
+		}
+
+		std::vector<float> up;
+		up.reserve(attack + decay);
+		for (Time i = 0; i < attack; ++i)
+			up.push_back(shape.ramp((float) i / attack));
+		for (Time i = 0; i < decay; ++i)
+			up.push_back(1 - (1 - shape.sustain) * shape.ramp((float) i / decay));
+		riseLength = up.size();
+		rise = std::make_shared<const std::vector<float>>(std::move(up));
+
+		releaseStart = length == FOREVER ? FOREVER : length - release;
+		std::vector<float> down;
+		if (length != FOREVER) {
+			float level = beforeRelease(releaseStart);
+			down.reserve(release);
+			for (Time i = 0; i < release; ++i)
+				down.push_back(level * (1 - shape.ramp((float) i / release)));
+		}
+		fall = std::make_shared<const std::vector<float>>(std::move(down));
+	}
+
+	Time getLength() const {
+		return length;
+	}
+
+	float at(Time t) const {
+		if (t < 0 || t >= length)
+			return 0;
+		if (t >= releaseStart)
+			return (*fall)[t - releaseStart];
+		return beforeRelease(t);
+	}
+
+	// gain[i] = at(t + i) for i in [0, frames)
+	void render(Time t, float* gain, int frames) const {
+		int i = 0;
+		while (i < frames) {
+			Time now = t + i;
+			int n;
+			if (now < 0) {
+				n = std::min(frames - i, -now);
+				std::fill(gain + i, gain + i + n, 0.0f);
+			} else if (now >= length) {
+				n = frames - i;
+				std::fill(gain + i, gain + i + n, 0.0f);
+			} else if (now >= releaseStart) {
+				n = std::min(frames - i, length - now);
+				std::copy(fall->begin() + (now - releaseStart), fall->begin() + (now - releaseStart + n), gain + i);
+			} else if (now < riseLength) {
+				n = std::min(frames - i, std::min(riseLength, releaseStart) - now);
+				std::copy(rise->begin() + now, rise->begin() + now + n, gain + i);
+			} else {
+				n = std::min(frames - i, releaseStart - now);
+				std::fill(gain + i, gain + i + n, sustain);
+			}
+			i += n;
+		}
+	}
+};
+
+// applies an ADSR envelope to a wave
+// usage: envelopeOf(finiteNote, Adsr(attack, decay, sustain, release))
 template<class WaveType>
 struct Envelope : public SoundSource<Envelope<WaveType>> {
 	WaveType wave;
-
-	const static constexpr float duration = seconds(0.1);
+	Adsr shape;
+	AdsrGain gain;
 	
 	Envelope() { };
-	Envelope(const SoundSource<WaveType>& wave) {
+	Envelope(const SoundSource<WaveType>& wave, const Adsr& shape = Adsr(), Time length = FOREVER) : shape(shape), gain(shape, length) {
 		this->wave.inherit(wave.get_ref());
 	}
 
@@ -542,22 +1454,32 @@ struct Envelope : public SoundSource<Envelope<WaveType>> {
 		return wave.maxAmp();
 	}
 
+	bool _stateless() const {
+		return wave.stateless();
+	}
+
+	TimeRange _activeRange() const {
+		return wave.activeRange().intersect(TimeRange(0, gain.getLength()));
+	}
+
 	float _sample(const Context& context) {
-		float val = wave.sample(context);
-		std::cout << context.time << ":" << context.duration << std::endl;
-		if (context.time < duration) {
-			std::cout << "ENVELOPE!" << std::endl;
-			return (context.time / duration) * val;
-		}
-		else if (context.time > context.duration - duration) {
-			std::cout << "ENVELOPE!" << std::endl;
-			return ((context.duration - context.time) / duration) * val;
+		return gain.at(context.time) * wave.sample(context);
+	}
+
+	void _render(const Context& context, float* out, int frames) {
+		wave.render(context, out, frames);
+		ScratchBlock tmp;
+		for (int done = 0; done < frames; done += BLOCK_SIZE) {
+			int n = std::min(BLOCK_SIZE, frames - done);
+			gain.render(context.time + done, tmp.data, n);
+			dsp::mulBlock(out + done, tmp.data, n);
 		}
-		return val;
 	}
 
 	void inherit(const Envelope<WaveType>& other) {
 		this->wave.inherit(other.wave);
+		this->shape = other.shape;
+		this->gain = other.gain;
 	}
 
 	std::string _toString() const {
@@ -565,14 +1487,16 @@ struct Envelope : public SoundSource<Envelope<WaveType>> {
 	}
 };
 
+// the release ends with the note
 template<class T>
-auto envelopeOf(const Finite<T>& wave) {
-	return finiteOf(Envelope<T>(wave), wave.getDuration());
+auto envelopeOf(const Finite<T>& wave, const Adsr& shape = Adsr()) {
+	return finiteOf(Envelope<T>(wave.wave, shape, wave.getDuration()), wave.getDuration());
 }
 
+// without a length the envelope holds the sustain level forever
 template<class T>
-auto envelopeOf(const SoundSource<T>& wave) {
-	return Envelope<T>(wave.get_ref());
+auto envelopeOf(const SoundSource<T>& wave, const Adsr& shape = Adsr(), Time length = FOREVER) {
+	return Envelope<T>(wave.get_ref(), shape, length);
 }
 
 }
@@ -0,0 +1,44 @@
+#include "threadpool.h"
+
+namespace synth {
+
+	ThreadPool::ThreadPool(int threads) {
+		stopping = false;
+		for (int i = 0; i < threads; ++i)
+			workers.emplace_back(&ThreadPool::work, this);
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	void ThreadPool::submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	void ThreadPool::work() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+}
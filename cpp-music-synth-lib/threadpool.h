@@ -0,0 +1,45 @@
+#ifndef __THREADPOOL_H_
+#define __THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace synth {
+
+	/*
+		a fixed set of worker threads pulling jobs off a shared queue.
+		jobs are run in the order they were submitted, the destructor waits for
+		every job that was already queued to finish.
+		usage: ThreadPool pool(4); pool.submit([] { ... });
+	*/
+	class ThreadPool {
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> jobs;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stopping;
+
+		void work();
+
+	public:
+		ThreadPool(int threads);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator = (const ThreadPool&) = delete;
+
+		void submit(std::function<void()> job);
+
+		int size() const {
+			return workers.size();
+		}
+	};
+
+};
+
+#endif
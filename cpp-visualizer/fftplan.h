@@ -0,0 +1,296 @@
+#ifndef __FFTPLAN_H_
+#define __FFTPLAN_H_
+
+/*
+	FFT PLANS
+	FFT<N> needs its size at compile time and only takes powers of two. an
+	FFTPlan is made at runtime for any size:
+	 - sizes whose prime factors are all at most MAX_RADIX are split into
+	   radix 4, 2, 3 and then generic prime butterflies (mixed radix),
+	 - any other size (a large prime, or a multiple of one) goes through
+	   bluestein's algorithm, a convolution done with a power of two plan.
+
+	a plan only holds its twiddle factors and is never changed after it is
+	made, so one plan is shared by every thread that needs that size. the
+	working memory of a transform comes from the caller as scratch, at least
+	scratchSize() values, so running a plan allocates nothing; keep one
+	scratch buffer per thread.
+
+	usage:
+		std::shared_ptr<const FFTPlan> plan = FFTPlan::get(1764);
+		std::vector<Complex> scratch(plan->scratchSize());
+		plan->forward(samples, bins, scratch.data());
+		plan->inverse(bins, samples, scratch.data());  // divides by size()
+
+	the input may be the same array as the output.
+*/
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "fft.h"
+
+class FFTPlan {
+public:
+	// the largest prime factor done with a butterfly of its own, sizes with larger ones use bluestein
+	static const int MAX_RADIX = 31;
+
+private:
+	struct Factor {
+		int radix;
+		int remaining; // the size of each sub transform below this level
+	};
+
+	int n;
+	std::vector<Factor> factors;
+	std::vector<Complex> twiddles; // omega(n, -k) for k < n
+
+	// bluestein only
+	std::shared_ptr<const FFTPlan> convolution;
+	std::vector<Complex> chirp;         // omega(2n, -k^2) for k < n
+	std::vector<Complex> chirpSpectrum; // the transform of the conjugated chirp, wrapped around
+
+	static int largestPrimeFactor(int size) {
+		int largest = 1;
+		for (int p = 2; p * p <= size; ++p) {
+			while (size % p == 0) {
+				largest = p;
+				size /= p;
+			}
+		}
+		return std::max(largest, size);
+	}
+
+	template<bool inverse>
+	Complex twiddle(int k) const {
+		return inverse ? std::conj(twiddles[k]) : twiddles[k];
+	}
+
+	/*
+		mixed radix
+		a decimation in time recursion: the radix sub transforms of every
+		radix-th input (starting at 0, 1, ...) are written one after the other
+		into out and then combined in place by the butterflies of this level.
+		stride is the distance of consecutive inputs at this level, which is
+		also the step through the twiddles of the full size.
+	*/
+	template<bool inverse>
+	void split(Complex* out, const Complex* in, int stride, int level, Complex* scratch) const {
+		const int radix = factors[level].radix;
+		const int m = factors[level].remaining;
+		if (m == 1) {
+			for (int q = 0; q < radix; ++q)
+				out[q] = in[q * stride];
+		} else {
+			for (int q = 0; q < radix; ++q)
+				split<inverse>(out + q * m, in + q * stride, stride * radix, level + 1, scratch);
+		}
+
+		switch (radix) {
+			case 2: radix2<inverse>(out, stride, m); break;
+			case 3: radix3<inverse>(out, stride, m); break;
+			case 4: radix4<inverse>(out, stride, m); break;
+			default: radixGeneric<inverse>(out, stride, m, radix, scratch); break;
+		}
+	}
+
+	template<bool inverse>
+	void radix2(Complex* out, int stride, int m) const {
+		for (int k = 0; k < m; ++k) {
+			Complex a = out[k];
+			Complex b = multiply(out[k + m], twiddle<inverse>(k * stride));
+			out[k] = a + b;
+			out[k + m] = a - b;
+		}
+	}
+
+	template<bool inverse>
+	void radix3(Complex* out, int stride, int m) const {
+		// omega(3, -1) = -1/2 - i sqrt(3)/2, the inverse turns the other way
+		const double sin60 = (inverse ? 1 : -1) * 0.86602540378443864676;
+		for (int k = 0; k < m; ++k) {
+			Complex a = out[k];
+			Complex b = multiply(out[k + m], twiddle<inverse>(k * stride));
+			Complex c = multiply(out[k + 2 * m], twiddle<inverse>(2 * k * stride));
+			Complex sum = b + c;
+			Complex middle = a - sum * 0.5;
+			Complex turned = Complex(-(b - c).imag(), (b - c).real()) * sin60;
+			out[k] = a + sum;
+			out[k + m] = middle + turned;
+			out[k + 2 * m] = middle - turned;
+		}
+	}
+
+	template<bool inverse>
+	void radix4(Complex* out, int stride, int m) const {
+		for (int k = 0; k < m; ++k) {
+			Complex a = out[k];
+			Complex b = multiply(out[k + m], twiddle<inverse>(k * stride));
+			Complex c = multiply(out[k + 2 * m], twiddle<inverse>(2 * k * stride));
+			Complex d = multiply(out[k + 3 * m], twiddle<inverse>(3 * k * stride));
+			Complex ac = a + c;
+			Complex difference = a - c;
+			Complex bd = b + d;
+			// (b - d) turned by -i, or by +i for the inverse
+			Complex turned = inverse ? Complex(-(b - d).imag(), (b - d).real()) : Complex((b - d).imag(), -(b - d).real());
+			out[k] = ac + bd;
+			out[k + m] = difference + turned;
+			out[k + 2 * m] = ac - bd;
+			out[k + 3 * m] = difference - turned;
+		}
+	}
+
+	// any other prime, an O(radix^2) dft per group of outputs
+	template<bool inverse>
+	void radixGeneric(Complex* out, int stride, int m, int radix, Complex* scratch) const {
+		const int step = stride * m; // omega(radix, -1) = omega(n, -step)
+		for (int k = 0; k < m; ++k) {
+			for (int q = 0; q < radix; ++q)
+				scratch[q] = multiply(out[k + q * m], twiddle<inverse>(q * k * stride));
+			for (int u = 0; u < radix; ++u) {
+				Complex sum = scratch[0];
+				int index = 0;
+				for (int q = 1; q < radix; ++q) {
+					index += u * step;
+					if (index >= n)
+						index -= n;
+					sum += multiply(scratch[q], twiddle<inverse>(index));
+				}
+				out[k + u * m] = sum;
+			}
+		}
+	}
+
+	template<bool inverse>
+	void mixedRadix(const Complex* in, Complex* out, Complex* scratch) const {
+		if (n == 1) {
+			out[0] = in[0];
+			return;
+		}
+		// the recursion reads the input while it writes the output, an in place call is copied first
+		if (in == out) {
+			std::copy(in, in + n, scratch);
+			in = scratch;
+			scratch += n;
+		}
+		split<inverse>(out, in, 1, 0, scratch);
+	}
+
+	/*
+		bluestein
+		with nk = (k^2 + n^2 - (k - n)^2) / 2 the dft becomes a convolution of
+		the input times a chirp with the conjugated chirp, done here with a
+		power of two transform of at least 2n - 1 points. the inverse is the
+		forward transform of the conjugated input, conjugated again.
+	*/
+	template<bool inverse>
+	void bluestein(const Complex* in, Complex* out, Complex* scratch) const {
+		const int m = convolution->size();
+		Complex* a = scratch;
+		Complex* spectrum = scratch + m;
+		Complex* rest = scratch + 2 * m;
+
+		for (int k = 0; k < n; ++k)
+			a[k] = multiply(inverse ? std::conj(in[k]) : in[k], chirp[k]);
+		std::fill(a + n, a + m, Complex(0, 0));
+
+		convolution->forward(a, spectrum, rest);
+		for (int k = 0; k < m; ++k)
+			spectrum[k] = multiply(spectrum[k], chirpSpectrum[k]);
+		convolution->inverse(spectrum, a, rest);
+
+		for (int k = 0; k < n; ++k) {
+			Complex value = multiply(a[k], chirp[k]);
+			out[k] = inverse ? std::conj(value) : value;
+		}
+	}
+
+	explicit FFTPlan(int size) : n(size) {
+		if (size < 1)
+			throw std::invalid_argument("an fft needs at least one sample");
+
+		if (largestPrimeFactor(size) <= MAX_RADIX) {
+			int remaining = size;
+			for (int radix : {4, 2, 3}) {
+				while (remaining % radix == 0) {
+					remaining /= radix;
+					factors.push_back(Factor{radix, remaining});
+				}
+			}
+			for (int radix = 5; remaining > 1; radix += 2) {
+				while (remaining % radix == 0) {
+					remaining /= radix;
+					factors.push_back(Factor{radix, remaining});
+				}
+			}
+			for (int k = 0; k < size; ++k)
+				twiddles.push_back(std::polar(1.0, -2 * pi * k / size));
+		} else {
+			int m = 1;
+			while (m < 2 * size - 1)
+				m *= 2;
+			convolution = get(m);
+
+			// k^2 mod 2n keeps the angle small and exact for large k
+			for (long long k = 0; k < size; ++k)
+				chirp.push_back(std::polar(1.0, -pi * (double) (k * k % (2 * size)) / size));
+
+			std::vector<Complex> wrapped(m, Complex(0, 0));
+			wrapped[0] = std::conj(chirp[0]);
+			for (int k = 1; k < size; ++k)
+				wrapped[k] = wrapped[m - k] = std::conj(chirp[k]);
+			chirpSpectrum.resize(m);
+			std::vector<Complex> work(convolution->scratchSize());
+			convolution->forward(wrapped.data(), chirpSpectrum.data(), work.data());
+		}
+	}
+
+public:
+	// the plan for size, made on first use and shared from then on
+	static std::shared_ptr<const FFTPlan> get(int size) {
+		static std::map<int, std::shared_ptr<const FFTPlan>> plans;
+		static std::mutex lock;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = plans.find(size);
+			if (found != plans.end())
+				return found->second;
+		}
+		// made outside the lock (a bluestein plan asks for another plan), if two threads race the first one wins
+		std::shared_ptr<const FFTPlan> plan(new FFTPlan(size));
+		std::lock_guard<std::mutex> guard(lock);
+		return plans.emplace(size, plan).first->second;
+	}
+
+	int size() const {
+		return n;
+	}
+
+	// the values of scratch forward and inverse need
+	int scratchSize() const {
+		if (convolution)
+			return 2 * convolution->size() + convolution->scratchSize();
+		return n + MAX_RADIX;
+	}
+
+	void forward(const Complex* in, Complex* out, Complex* scratch) const {
+		if (convolution)
+			bluestein<false>(in, out, scratch);
+		else
+			mixedRadix<false>(in, out, scratch);
+	}
+
+	// the inverse transform, divided by size() so inverse(forward(x)) = x
+	void inverse(const Complex* in, Complex* out, Complex* scratch) const {
+		if (convolution)
+			bluestein<true>(in, out, scratch);
+		else
+			mixedRadix<true>(in, out, scratch);
+		for (int k = 0; k < n; ++k)
+			out[k] /= (double) n;
+	}
+};
+
+#endif
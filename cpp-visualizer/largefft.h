@@ -0,0 +1,170 @@
+#ifndef __LARGEFFT_H_
+#define __LARGEFFT_H_
+
+/*
+	LARGE FFTS
+	a transform for whole tracks, 2^16 to 2^24 samples and more. the samples
+	are seen as a rows x columns matrix (rows * columns = size, both close
+	to sqrt(size)) and transformed in six steps:
+	 1. transpose, so every column is a row
+	 2. a transform of every row, then twiddle factors omega(size, -row * column)
+	 3. transpose back
+	 4. a transform of every row
+	 5. transpose once more into the output order
+	 6. copy to out
+	every row transform is a small FFTPlan working on a few kilobytes that
+	stay in cache, and the transposes go through 32x32 tiles, so the whole
+	array is only streamed through memory a few times.
+
+	the scratch matrix (size values) and one FFTPlan scratch buffer per
+	thread are allocated when the plan is made, a transform allocates
+	nothing. given a thread pool the rows of every step are split across its
+	workers and the calling thread. as a plan owns its scratch, one plan is
+	used by one thread at a time.
+
+	usage:
+		ThreadPool pool(std::thread::hardware_concurrency() - 1);
+		LargeFFT fft(1 << 22, &pool);
+		fft.forward(samples, bins);  // may be the same array
+		fft.inverse(bins, samples);  // divides by size()
+*/
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "fft.h"
+#include "fftplan.h"
+#include "threadpool.h"
+
+class LargeFFT {
+private:
+	static const int TILE = 32;
+
+	int n;
+	int rows;
+	int columns;
+	ThreadPool* pool;
+	std::shared_ptr<const FFTPlan> columnPlan; // rows points, for the columns in step 2
+	std::shared_ptr<const FFTPlan> rowPlan;    // columns points, for the rows in step 4
+	std::vector<Complex> scratch;
+	std::vector<std::vector<Complex>> planScratch; // one per part of parallelFor
+
+	// omega(n, -e) = high[e / split] * low[e % split], two tables of about sqrt(n) values
+	int split;
+	std::vector<Complex> high;
+	std::vector<Complex> low;
+
+	// the largest factor of size that is at most its square root
+	static int squareFactor(int size) {
+		int factor = 1;
+		for (int f = 1; (long long) f * f <= size; ++f) {
+			if (size % f == 0)
+				factor = f;
+		}
+		return factor;
+	}
+
+	// dst (width x height) = the transpose of src (height x width), for the source rows [begin, end)
+	static void transpose(const Complex* src, Complex* dst, int height, int width, int begin, int end) {
+		for (int r = begin; r < end; r += TILE) {
+			int rEnd = std::min(r + TILE, end);
+			for (int c = 0; c < width; c += TILE) {
+				int cEnd = std::min(c + TILE, width);
+				for (int i = r; i < rEnd; ++i) {
+					for (int j = c; j < cEnd; ++j)
+						dst[(size_t) j * height + i] = src[(size_t) i * width + j];
+				}
+			}
+		}
+	}
+
+	// transposes src into dst, split across the pool in bands of whole tiles
+	void transposeAll(const Complex* src, Complex* dst, int height, int width) {
+		int tiles = (height + TILE - 1) / TILE;
+		parallelFor(pool, tiles, [&](int begin, int end, int) {
+			transpose(src, dst, height, width, begin * TILE, std::min(end * TILE, height));
+		});
+	}
+
+	template<bool inverse>
+	void run(const Complex* in, Complex* out) {
+		// the matrix of in is rows x columns, element (j1, j2) = in[j1 * columns + j2]
+		Complex* work = scratch.data();
+
+		transposeAll(in, work, rows, columns);
+
+		// row j2 of work is column j2 of in
+		parallelFor(pool, columns, [&](int begin, int end, int part) {
+			Complex* sub = planScratch[part].data();
+			for (int j2 = begin; j2 < end; ++j2) {
+				Complex* row = work + (size_t) j2 * rows;
+				if (inverse)
+					columnPlan->inverse(row, row, sub);
+				else
+					columnPlan->forward(row, row, sub);
+				for (int k1 = 0; k1 < rows; ++k1) {
+					long long e = (long long) j2 * k1;
+					Complex w = multiply(high[e / split], low[e % split]);
+					row[k1] = multiply(row[k1], inverse ? std::conj(w) : w);
+				}
+			}
+		});
+
+		transposeAll(work, out, columns, rows);
+
+		parallelFor(pool, rows, [&](int begin, int end, int part) {
+			Complex* sub = planScratch[part].data();
+			for (int k1 = begin; k1 < end; ++k1) {
+				Complex* row = out + (size_t) k1 * columns;
+				if (inverse)
+					rowPlan->inverse(row, row, sub);
+				else
+					rowPlan->forward(row, row, sub);
+			}
+		});
+
+		// bin k1 + rows * k2 is element (k1, k2) of out
+		transposeAll(out, work, rows, columns);
+		parallelFor(pool, n, [&](int begin, int end, int) {
+			std::copy(work + begin, work + end, out + begin);
+		});
+	}
+
+public:
+	LargeFFT(int size, ThreadPool* pool = nullptr) : n(size), pool(pool) {
+		rows = squareFactor(size);
+		columns = size / rows;
+		columnPlan = FFTPlan::get(rows);
+		rowPlan = FFTPlan::get(columns);
+
+		scratch.resize(size);
+		int sub = std::max(columnPlan->scratchSize(), rowPlan->scratchSize());
+		planScratch.resize(parallelParts(pool), std::vector<Complex>(sub));
+
+		split = 1;
+		while ((long long) split * split < size)
+			++split;
+		for (int i = 0; i <= (size - 1) / split; ++i)
+			high.push_back(std::polar(1.0, -2 * pi * ((double) i * split) / size));
+		for (int i = 0; i < split; ++i)
+			low.push_back(std::polar(1.0, -2 * pi * i / size));
+	}
+
+	LargeFFT(const LargeFFT&) = delete;
+	LargeFFT& operator = (const LargeFFT&) = delete;
+
+	int size() const {
+		return n;
+	}
+
+	void forward(const Complex* in, Complex* out) {
+		run<false>(in, out);
+	}
+
+	// the inverse transform, divided by size()
+	void inverse(const Complex* in, Complex* out) {
+		run<true>(in, out);
+	}
+};
+
+#endif
@@ -64,16 +64,18 @@ struct RecorderVisualizer : sf::SoundRecorder {
         float w = this->renderWindow.getSize().x;
         float h = this->renderWindow.getSize().y;
         
-        Complex input[bufferSize];
+        double input[bufferSize];
         for (int i = 0; i < bufferSize; ++i) {
-            input[i] = Complex(buffer[i] / ((float) INT16_MAX), 0);
+            input[i] = buffer[i] / ((float) INT16_MAX);
         }
         
-        Complex output[bufferSize];
-        FFT<bufferSize>::run(input, output);
+        // the input is real, so the bins above bufferSize / 2 only mirror the ones below
+        const int bins = bufferSize / 2 + 1;
+        Complex output[bins];
+        RFFT<bufferSize>::run(input, output);
         
-        float barW = w / ((float) bufferSize);
-        for (int i = 0; i < bufferSize; ++i) {
+        float barW = w / ((float) bins);
+        for (int i = 0; i < bins; ++i) {
             float energy = std::abs(output[i]);
             sf::RectangleShape rect;
             rect.setSize(sf::Vector2f(barW, energy * h));
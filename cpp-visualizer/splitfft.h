@@ -0,0 +1,476 @@
+#ifndef __SPLITFFT_H_
+#define __SPLITFFT_H_
+
+/*
+	SPLIT COMPLEX FLOAT FFT
+	a single precision transform for analysis and display, where double
+	precision buys nothing. the real and imaginary parts are kept in two
+	separate float arrays, so a vector register holds 8 (AVX2) or 16
+	(AVX-512) real parts or imaginary parts and the butterflies need no
+	shuffling.
+
+	the layout is the one of FFT<N>: bit reversal, then radix 4 levels in
+	place. on the vector path the first three levels are one size 8 dft per
+	group of 8 values, done for 8 groups at once on a transposed 8x8 tile.
+	the kernels (scalar, AVX2, AVX2 + AVX-512) are picked for the running
+	cpu once, like the kernels of the synth's dsp.cpp.
+
+	sizes are powers of two, use FFTPlan for others. a plan is immutable,
+	shared per size and needs no scratch, both transforms work in place.
+
+	accuracy: every bin is within 1e-6 * (log2(N) + 1) * sqrt(sum |x|^2) of
+	FFT<N> in double, on every kernel. the errors measured on random input up
+	to N = 2^16 stay below 5% of that bound.
+
+	usage:
+		std::shared_ptr<const SplitFFT> fft = SplitFFT::get(2048);
+		fft->forward(re, im);  // re[i] + i im[i], i < 2048, replaced by the bins
+		fft->inverse(re, im);  // divides by size()
+*/
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "fft.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPLITFFT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace splitfft {
+
+	/*
+		one radix 2 level with half size h: twiddles wr/wi hold omega(2h, -j), j < h
+		one radix 4 level with quarter size q: tw holds the real parts of
+		omega(4q, -j) for j < q, then the imaginary parts, then the same for
+		omega(4q, -2j) and omega(4q, -3j), 6 * q floats
+	*/
+	static void radix2Scalar(float* re, float* im, int n, int h, const float* wr, const float* wi) {
+		for (int i = 0; i < n; i += 2 * h) {
+			for (int j = i; j < i + h; ++j) {
+				float br = re[j + h] * wr[j - i] - im[j + h] * wi[j - i];
+				float bi = re[j + h] * wi[j - i] + im[j + h] * wr[j - i];
+				re[j + h] = re[j] - br;
+				im[j + h] = im[j] - bi;
+				re[j] += br;
+				im[j] += bi;
+			}
+		}
+	}
+
+	static void radix4Scalar(float* re, float* im, int n, int q, const float* tw) {
+		const float* w1r = tw;
+		const float* w1i = tw + q;
+		const float* w2r = tw + 2 * q;
+		const float* w2i = tw + 3 * q;
+		const float* w3r = tw + 4 * q;
+		const float* w3i = tw + 5 * q;
+		for (int i = 0; i < n; i += 4 * q) {
+			float* xr = re + i;
+			float* xi = im + i;
+			for (int j = 0; j < q; ++j) {
+				// after bit reversal the even half of each sub transform comes first, see FFT<N>
+				float ar = xr[j], ai = xi[j];
+				float br = xr[j + q] * w2r[j] - xi[j + q] * w2i[j];
+				float bi = xr[j + q] * w2i[j] + xi[j + q] * w2r[j];
+				float cr = xr[j + 2 * q] * w1r[j] - xi[j + 2 * q] * w1i[j];
+				float ci = xr[j + 2 * q] * w1i[j] + xi[j + 2 * q] * w1r[j];
+				float dr = xr[j + 3 * q] * w3r[j] - xi[j + 3 * q] * w3i[j];
+				float di = xr[j + 3 * q] * w3i[j] + xi[j + 3 * q] * w3r[j];
+
+				float sr = ar + br, si = ai + bi;
+				float tr = ar - br, ti = ai - bi;
+				float ur = cr + dr, ui = ci + di;
+				float vr = cr - dr, vi = ci - di;
+				xr[j] = sr + ur;
+				xi[j] = si + ui;
+				xr[j + q] = tr + vi;
+				xi[j + q] = ti - vr;
+				xr[j + 2 * q] = sr - ur;
+				xi[j + 2 * q] = si - ui;
+				xr[j + 3 * q] = tr - vi;
+				xi[j + 3 * q] = ti + vr;
+			}
+		}
+	}
+
+#ifdef SPLITFFT_X86
+	/*
+		AVX2
+		the size 8 dfts: three radix 2 levels down the columns of 8x8 tiles, so
+		every add works on 8 groups. the twiddles of a size 8 dft are 1, -i and
+		(1 - i) / sqrt(2) and its multiples.
+	*/
+	__attribute__((target("avx2,fma")))
+	static inline void transpose8(__m256* rows) {
+		__m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+		__m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+		__m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+		__m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+		__m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+		__m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+		__m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+		__m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+		rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+		rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+		rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+		rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+		rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+		rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+		rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+		rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+	}
+
+	__attribute__((target("avx2,fma")))
+	static inline void butterfly8(__m256& ar, __m256& ai, __m256& br, __m256& bi) {
+		__m256 tr = ar, ti = ai;
+		ar = _mm256_add_ps(tr, br);
+		ai = _mm256_add_ps(ti, bi);
+		br = _mm256_sub_ps(tr, br);
+		bi = _mm256_sub_ps(ti, bi);
+	}
+
+	// times -i
+	__attribute__((target("avx2,fma")))
+	static inline void turn8(__m256& r, __m256& i) {
+		__m256 t = r;
+		r = i;
+		i = _mm256_sub_ps(_mm256_setzero_ps(), t);
+	}
+
+	// times omega(8, -1) = (1 - i) / sqrt(2), or omega(8, -3) = -(1 + i) / sqrt(2)
+	__attribute__((target("avx2,fma")))
+	static inline void eighth8(__m256& r, __m256& i, bool third) {
+		const __m256 scale = _mm256_set1_ps(0.70710678118654752f);
+		__m256 t = r;
+		if (third) {
+			r = _mm256_mul_ps(_mm256_sub_ps(i, t), scale);
+			i = _mm256_mul_ps(_mm256_add_ps(t, i), _mm256_sub_ps(_mm256_setzero_ps(), scale));
+		} else {
+			r = _mm256_mul_ps(_mm256_add_ps(t, i), scale);
+			i = _mm256_mul_ps(_mm256_sub_ps(i, t), scale);
+		}
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void leafAVX2(float* re, float* im, int n) {
+		__m256 r[8], x[8];
+		for (int i = 0; i < n; i += 64) {
+			for (int k = 0; k < 8; ++k) {
+				r[k] = _mm256_loadu_ps(re + i + 8 * k);
+				x[k] = _mm256_loadu_ps(im + i + 8 * k);
+			}
+			transpose8(r);
+			transpose8(x);
+
+			for (int k = 0; k < 8; k += 2)
+				butterfly8(r[k], x[k], r[k + 1], x[k + 1]);
+
+			turn8(r[3], x[3]);
+			turn8(r[7], x[7]);
+			for (int k = 0; k < 8; k += 4) {
+				butterfly8(r[k], x[k], r[k + 2], x[k + 2]);
+				butterfly8(r[k + 1], x[k + 1], r[k + 3], x[k + 3]);
+			}
+
+			eighth8(r[5], x[5], false);
+			turn8(r[6], x[6]);
+			eighth8(r[7], x[7], true);
+			for (int k = 0; k < 4; ++k)
+				butterfly8(r[k], x[k], r[k + 4], x[k + 4]);
+
+			transpose8(r);
+			transpose8(x);
+			for (int k = 0; k < 8; ++k) {
+				_mm256_storeu_ps(re + i + 8 * k, r[k]);
+				_mm256_storeu_ps(im + i + 8 * k, x[k]);
+			}
+		}
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void radix2AVX2(float* re, float* im, int n, int h, const float* wr, const float* wi) {
+		for (int i = 0; i < n; i += 2 * h) {
+			for (int j = 0; j < h; j += 8) {
+				float* ar = re + i + j;
+				float* ai = im + i + j;
+				__m256 xr = _mm256_loadu_ps(ar + h);
+				__m256 xi = _mm256_loadu_ps(ai + h);
+				__m256 twr = _mm256_loadu_ps(wr + j);
+				__m256 twi = _mm256_loadu_ps(wi + j);
+				__m256 br = _mm256_fmsub_ps(xr, twr, _mm256_mul_ps(xi, twi));
+				__m256 bi = _mm256_fmadd_ps(xr, twi, _mm256_mul_ps(xi, twr));
+				__m256 yr = _mm256_loadu_ps(ar);
+				__m256 yi = _mm256_loadu_ps(ai);
+				_mm256_storeu_ps(ar, _mm256_add_ps(yr, br));
+				_mm256_storeu_ps(ai, _mm256_add_ps(yi, bi));
+				_mm256_storeu_ps(ar + h, _mm256_sub_ps(yr, br));
+				_mm256_storeu_ps(ai + h, _mm256_sub_ps(yi, bi));
+			}
+		}
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void radix4AVX2(float* re, float* im, int n, int q, const float* tw) {
+		for (int i = 0; i < n; i += 4 * q) {
+			float* xr = re + i;
+			float* xi = im + i;
+			for (int j = 0; j < q; j += 8) {
+				__m256 w1r = _mm256_loadu_ps(tw + j);
+				__m256 w1i = _mm256_loadu_ps(tw + q + j);
+				__m256 w2r = _mm256_loadu_ps(tw + 2 * q + j);
+				__m256 w2i = _mm256_loadu_ps(tw + 3 * q + j);
+				__m256 w3r = _mm256_loadu_ps(tw + 4 * q + j);
+				__m256 w3i = _mm256_loadu_ps(tw + 5 * q + j);
+
+				__m256 ar = _mm256_loadu_ps(xr + j);
+				__m256 ai = _mm256_loadu_ps(xi + j);
+				__m256 er = _mm256_loadu_ps(xr + j + q);
+				__m256 ei = _mm256_loadu_ps(xi + j + q);
+				__m256 br = _mm256_fmsub_ps(er, w2r, _mm256_mul_ps(ei, w2i));
+				__m256 bi = _mm256_fmadd_ps(er, w2i, _mm256_mul_ps(ei, w2r));
+				er = _mm256_loadu_ps(xr + j + 2 * q);
+				ei = _mm256_loadu_ps(xi + j + 2 * q);
+				__m256 cr = _mm256_fmsub_ps(er, w1r, _mm256_mul_ps(ei, w1i));
+				__m256 ci = _mm256_fmadd_ps(er, w1i, _mm256_mul_ps(ei, w1r));
+				er = _mm256_loadu_ps(xr + j + 3 * q);
+				ei = _mm256_loadu_ps(xi + j + 3 * q);
+				__m256 dr = _mm256_fmsub_ps(er, w3r, _mm256_mul_ps(ei, w3i));
+				__m256 di = _mm256_fmadd_ps(er, w3i, _mm256_mul_ps(ei, w3r));
+
+				__m256 sr = _mm256_add_ps(ar, br), si = _mm256_add_ps(ai, bi);
+				__m256 tr = _mm256_sub_ps(ar, br), ti = _mm256_sub_ps(ai, bi);
+				__m256 ur = _mm256_add_ps(cr, dr), ui = _mm256_add_ps(ci, di);
+				__m256 vr = _mm256_sub_ps(cr, dr), vi = _mm256_sub_ps(ci, di);
+				_mm256_storeu_ps(xr + j, _mm256_add_ps(sr, ur));
+				_mm256_storeu_ps(xi + j, _mm256_add_ps(si, ui));
+				_mm256_storeu_ps(xr + j + q, _mm256_add_ps(tr, vi));
+				_mm256_storeu_ps(xi + j + q, _mm256_sub_ps(ti, vr));
+				_mm256_storeu_ps(xr + j + 2 * q, _mm256_sub_ps(sr, ur));
+				_mm256_storeu_ps(xi + j + 2 * q, _mm256_sub_ps(si, ui));
+				_mm256_storeu_ps(xr + j + 3 * q, _mm256_sub_ps(tr, vi));
+				_mm256_storeu_ps(xi + j + 3 * q, _mm256_add_ps(ti, vr));
+			}
+		}
+	}
+
+	/*
+		AVX-512
+		only the radix 4 levels are wider, a level with a quarter size below 16
+		and the size 8 dfts stay on AVX2.
+	*/
+	__attribute__((target("avx512f,avx2,fma")))
+	static void radix4AVX512(float* re, float* im, int n, int q, const float* tw) {
+		if (q < 16) {
+			radix4AVX2(re, im, n, q, tw);
+			return;
+		}
+		for (int i = 0; i < n; i += 4 * q) {
+			float* xr = re + i;
+			float* xi = im + i;
+			for (int j = 0; j < q; j += 16) {
+				__m512 w1r = _mm512_loadu_ps(tw + j);
+				__m512 w1i = _mm512_loadu_ps(tw + q + j);
+				__m512 w2r = _mm512_loadu_ps(tw + 2 * q + j);
+				__m512 w2i = _mm512_loadu_ps(tw + 3 * q + j);
+				__m512 w3r = _mm512_loadu_ps(tw + 4 * q + j);
+				__m512 w3i = _mm512_loadu_ps(tw + 5 * q + j);
+
+				__m512 ar = _mm512_loadu_ps(xr + j);
+				__m512 ai = _mm512_loadu_ps(xi + j);
+				__m512 er = _mm512_loadu_ps(xr + j + q);
+				__m512 ei = _mm512_loadu_ps(xi + j + q);
+				__m512 br = _mm512_fmsub_ps(er, w2r, _mm512_mul_ps(ei, w2i));
+				__m512 bi = _mm512_fmadd_ps(er, w2i, _mm512_mul_ps(ei, w2r));
+				er = _mm512_loadu_ps(xr + j + 2 * q);
+				ei = _mm512_loadu_ps(xi + j + 2 * q);
+				__m512 cr = _mm512_fmsub_ps(er, w1r, _mm512_mul_ps(ei, w1i));
+				__m512 ci = _mm512_fmadd_ps(er, w1i, _mm512_mul_ps(ei, w1r));
+				er = _mm512_loadu_ps(xr + j + 3 * q);
+				ei = _mm512_loadu_ps(xi + j + 3 * q);
+				__m512 dr = _mm512_fmsub_ps(er, w3r, _mm512_mul_ps(ei, w3i));
+				__m512 di = _mm512_fmadd_ps(er, w3i, _mm512_mul_ps(ei, w3r));
+
+				__m512 sr = _mm512_add_ps(ar, br), si = _mm512_add_ps(ai, bi);
+				__m512 tr = _mm512_sub_ps(ar, br), ti = _mm512_sub_ps(ai, bi);
+				__m512 ur = _mm512_add_ps(cr, dr), ui = _mm512_add_ps(ci, di);
+				__m512 vr = _mm512_sub_ps(cr, dr), vi = _mm512_sub_ps(ci, di);
+				_mm512_storeu_ps(xr + j, _mm512_add_ps(sr, ur));
+				_mm512_storeu_ps(xi + j, _mm512_add_ps(si, ui));
+				_mm512_storeu_ps(xr + j + q, _mm512_add_ps(tr, vi));
+				_mm512_storeu_ps(xi + j + q, _mm512_sub_ps(ti, vr));
+				_mm512_storeu_ps(xr + j + 2 * q, _mm512_sub_ps(sr, ur));
+				_mm512_storeu_ps(xi + j + 2 * q, _mm512_sub_ps(si, ui));
+				_mm512_storeu_ps(xr + j + 3 * q, _mm512_sub_ps(tr, vi));
+				_mm512_storeu_ps(xi + j + 3 * q, _mm512_add_ps(ti, vr));
+			}
+		}
+	}
+#endif
+
+	/*
+		runtime dispatch
+		leaf is nullptr when the first three levels run as plain radix 2 levels.
+	*/
+	struct Kernels {
+		void (*leaf)(float* re, float* im, int n);
+		void (*radix2)(float* re, float* im, int n, int h, const float* wr, const float* wi);
+		void (*radix4)(float* re, float* im, int n, int q, const float* tw);
+	};
+
+	static Kernels pickKernels() {
+#ifdef SPLITFFT_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return Kernels{leafAVX2, radix2AVX2, radix4AVX512};
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return Kernels{leafAVX2, radix2AVX2, radix4AVX2};
+#endif
+		return Kernels{nullptr, radix2Scalar, radix4Scalar};
+	}
+
+	static const Kernels& kernels() {
+		static const Kernels best = pickKernels();
+		return best;
+	}
+
+}
+
+class SplitFFT {
+private:
+	struct Level {
+		int radix; // 2 or 4
+		int size;  // the half (radix 2) or quarter (radix 4) size of the level
+		int twiddles; // the offset of its twiddles in twiddles
+	};
+
+	int n;
+	std::vector<std::pair<int, int>> swaps; // bit reversal, i < reverse(i)
+	std::vector<Level> levels;
+	std::vector<float> twiddles;
+
+	void addRadix2(int h) {
+		levels.push_back(Level{2, h, (int) twiddles.size()});
+		for (int part = 0; part < 2; ++part) {
+			for (int j = 0; j < h; ++j) {
+				Complex w = std::polar(1.0, -pi * j / h);
+				twiddles.push_back(part ? w.imag() : w.real());
+			}
+		}
+	}
+
+	void addRadix4(int q) {
+		levels.push_back(Level{4, q, (int) twiddles.size()});
+		for (int power = 1; power <= 3; ++power) {
+			for (int part = 0; part < 2; ++part) {
+				for (int j = 0; j < q; ++j) {
+					Complex w = std::polar(1.0, -pi * power * j / (2 * q));
+					twiddles.push_back(part ? w.imag() : w.real());
+				}
+			}
+		}
+	}
+
+	explicit SplitFFT(int size) : n(size) {
+		if (size < 1 || (size & (size - 1)) != 0)
+			throw std::invalid_argument("a split fft needs a power of two size");
+
+		int bits = 0;
+		while ((1 << bits) < size)
+			++bits;
+		for (int i = 0; i < size; ++i) {
+			int reversed = 0;
+			for (int b = 0; b < bits; ++b)
+				reversed |= ((i >> b) & 1) << (bits - 1 - b);
+			if (i < reversed)
+				swaps.push_back(std::make_pair(i, reversed));
+		}
+
+		// the first three levels are radix 2 so they can be swapped for the size 8 dfts
+		int h = 1;
+		for (; h < 8 && h < size; h *= 2)
+			addRadix2(h);
+		if (h < size && (bits - 3) % 2) {
+			addRadix2(h);
+			h *= 2;
+		}
+		for (; h < size; h *= 4)
+			addRadix4(h);
+	}
+
+	void run(float* re, float* im, const splitfft::Kernels& kernels) const {
+		for (const std::pair<int, int>& swap : swaps) {
+			std::swap(re[swap.first], re[swap.second]);
+			std::swap(im[swap.first], im[swap.second]);
+		}
+
+		size_t first = 0;
+		// the vector leaf works on tiles of 8 groups of 8
+		if (kernels.leaf != nullptr && n >= 64) {
+			kernels.leaf(re, im, n);
+			first = 3;
+		}
+		for (size_t l = first; l < levels.size(); ++l) {
+			const Level& level = levels[l];
+			const float* tw = twiddles.data() + level.twiddles;
+			// the vector kernels need 8 values per row of a level
+			const splitfft::Kernels& use = level.size >= 8 ? kernels : scalarKernels();
+			if (level.radix == 2)
+				use.radix2(re, im, n, level.size, tw, tw + level.size);
+			else
+				use.radix4(re, im, n, level.size, tw);
+		}
+	}
+
+	static const splitfft::Kernels& scalarKernels() {
+		static const splitfft::Kernels scalar{nullptr, splitfft::radix2Scalar, splitfft::radix4Scalar};
+		return scalar;
+	}
+
+public:
+	// the plan for size, made on first use and shared from then on
+	static std::shared_ptr<const SplitFFT> get(int size) {
+		static std::map<int, std::shared_ptr<const SplitFFT>> plans;
+		static std::mutex lock;
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = plans.find(size);
+		if (found != plans.end())
+			return found->second;
+		std::shared_ptr<const SplitFFT> plan(new SplitFFT(size));
+		plans.emplace(size, plan);
+		return plan;
+	}
+
+	int size() const {
+		return n;
+	}
+
+	void forward(float* re, float* im) const {
+		run(re, im, splitfft::kernels());
+	}
+
+	// the inverse transform, divided by size(). swapping the real and imaginary parts
+	// conjugates and turns by i, which turns the forward transform into the inverse
+	void inverse(float* re, float* im) const {
+		run(im, re, splitfft::kernels());
+		const float scale = 1.0f / n;
+		for (int i = 0; i < n; ++i) {
+			re[i] *= scale;
+			im[i] *= scale;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef __STFT_H_
+#define __STFT_H_
+
+/*
+	SHORT TIME FOURIER TRANSFORM
+	the spectrum of every frame of a whole buffer in one call. frame f is
+	the size samples from f * hop on, times the window, and its row of the
+	spectrogram holds the magnitudes of its size / 2 + 1 bins. magnitudes
+	are scaled by size / (sum of the window), so a steady tone reads the same
+	whatever the window, at the height a rectangular window gives it.
+
+	the frames are real, so two of them go through one complex transform
+	(the first as real parts, the second as imaginary parts) and are split
+	apart afterwards. power of two sizes use the float SplitFFT, other sizes
+	an FFTPlan. given a thread pool the frame pairs are split across its
+	workers and the calling thread.
+
+	the spectrogram is one block of memory, every row starts on a cache line.
+
+	usage:
+		StftSettings settings;
+		settings.size = 1764;
+		settings.hop = 441;
+		settings.window = Window::HANN;
+		Spectrogram spectrogram = stft(samples, count, settings, &pool);
+		const float* bins = spectrogram.frame(f);  // spectrogram.bins() values
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "fft.h"
+#include "fftplan.h"
+#include "splitfft.h"
+#include "threadpool.h"
+
+enum class Window { RECTANGULAR, HANN, HAMMING, BLACKMAN };
+
+struct StftSettings {
+	int size;      // samples per frame
+	int hop;       // samples from the start of one frame to the next
+	Window window;
+
+	StftSettings() : size(1024), hop(512), window(Window::HANN) { };
+};
+
+// the window of settings.window, size values, periodic so overlapping frames add up evenly
+inline std::vector<float> makeWindow(Window window, int size) {
+	std::vector<float> values(size);
+	for (int i = 0; i < size; ++i) {
+		double x = 2 * pi * i / size;
+		switch (window) {
+			case Window::RECTANGULAR: values[i] = 1; break;
+			case Window::HANN: values[i] = 0.5 - 0.5 * std::cos(x); break;
+			case Window::HAMMING: values[i] = 0.54 - 0.46 * std::cos(x); break;
+			case Window::BLACKMAN: values[i] = 0.42 - 0.5 * std::cos(x) + 0.08 * std::cos(2 * x); break;
+		}
+	}
+	return values;
+}
+
+class Spectrogram {
+private:
+	static const int LINE_FLOATS = 64 / sizeof(float);
+
+	size_t frameCount;
+	int binCount;
+	int rowStride; // bins rounded up to whole cache lines
+	std::unique_ptr<float[]> storage;
+	float* values; // storage moved up to a cache line
+
+public:
+	Spectrogram() : frameCount(0), binCount(0), rowStride(0), values(nullptr) { };
+
+	Spectrogram(size_t frames, int bins) : frameCount(frames), binCount(bins) {
+		rowStride = (bins + LINE_FLOATS - 1) / LINE_FLOATS * LINE_FLOATS;
+		storage.reset(new float[frames * rowStride + LINE_FLOATS]);
+		uintptr_t address = reinterpret_cast<uintptr_t>(storage.get());
+		values = storage.get() + (LINE_FLOATS - address / sizeof(float) % LINE_FLOATS) % LINE_FLOATS;
+	}
+
+	size_t frames() const {
+		return frameCount;
+	}
+
+	int bins() const {
+		return binCount;
+	}
+
+	// the distance in floats from one row to the next
+	int stride() const {
+		return rowStride;
+	}
+
+	float* frame(size_t f) {
+		return values + f * rowStride;
+	}
+
+	const float* frame(size_t f) const {
+		return values + f * rowStride;
+	}
+};
+
+// the spectrogram of samples[0, count), frames that would run past the end are left out
+inline Spectrogram stft(const float* samples, size_t count, const StftSettings& settings, ThreadPool* pool = nullptr) {
+	const int n = settings.size;
+	if (n < 1 || settings.hop < 1)
+		throw std::invalid_argument("an stft needs a frame size and a hop of at least one sample");
+
+	const size_t frames = count < (size_t) n ? 0 : (count - n) / settings.hop + 1;
+	const int bins = n / 2 + 1;
+	Spectrogram spectrogram(frames, bins);
+	if (frames == 0)
+		return spectrogram;
+
+	// folded into the window: size / its sum, 1 for a rectangular window
+	std::vector<float> window = makeWindow(settings.window, n);
+	double sum = 0;
+	for (float value : window)
+		sum += value;
+	for (float& value : window)
+		value *= (float) (n / sum);
+	std::shared_ptr<const SplitFFT> split;
+	std::shared_ptr<const FFTPlan> plan;
+	if ((n & (n - 1)) == 0)
+		split = SplitFFT::get(n);
+	else
+		plan = FFTPlan::get(n);
+
+	// per part: the split complex frame pair, and for an FFTPlan its complex copy and scratch
+	struct Buffers {
+		std::vector<float> re, im;
+		std::vector<Complex> complex, scratch;
+	};
+	std::vector<Buffers> buffers(parallelParts(pool));
+	for (Buffers& b : buffers) {
+		b.re.resize(n);
+		b.im.resize(n);
+		if (plan) {
+			b.complex.resize(n);
+			b.scratch.resize(plan->scratchSize());
+		}
+	}
+
+	const size_t pairs = (frames + 1) / 2;
+	parallelFor(pool, (int) pairs, [&](int begin, int end, int part) {
+		Buffers& b = buffers[part];
+		for (size_t pair = begin; pair < (size_t) end; ++pair) {
+			size_t first = 2 * pair;
+			bool second = first + 1 < frames;
+			const float* a = samples + first * settings.hop;
+			const float* c = second ? a + settings.hop : nullptr;
+			for (int i = 0; i < n; ++i) {
+				b.re[i] = a[i] * window[i];
+				b.im[i] = second ? c[i] * window[i] : 0;
+			}
+
+			if (split) {
+				split->forward(b.re.data(), b.im.data());
+			} else {
+				for (int i = 0; i < n; ++i)
+					b.complex[i] = Complex(b.re[i], b.im[i]);
+				plan->forward(b.complex.data(), b.complex.data(), b.scratch.data());
+				for (int i = 0; i < n; ++i) {
+					b.re[i] = b.complex[i].real();
+					b.im[i] = b.complex[i].imag();
+				}
+			}
+
+			// z = a + i c gives a's bins as (z[k] + conj z[n - k]) / 2 and c's as (z[k] - conj z[n - k]) / 2i
+			float* rowA = spectrogram.frame(first);
+			float* rowC = second ? spectrogram.frame(first + 1) : nullptr;
+			for (int k = 0; k < bins; ++k) {
+				int mirror = k == 0 ? 0 : n - k;
+				float zr = b.re[k], zi = b.im[k];
+				float mr = b.re[mirror], mi = b.im[mirror];
+				float ar = zr + mr, ai = zi - mi;
+				rowA[k] = 0.5f * std::sqrt(ar * ar + ai * ai);
+				if (rowC) {
+					float cr = zi + mi, ci = zr - mr;
+					rowC[k] = 0.5f * std::sqrt(cr * cr + ci * ci);
+				}
+			}
+		}
+	});
+	return spectrogram;
+}
+
+#endif
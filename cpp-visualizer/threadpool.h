@@ -0,0 +1,113 @@
+#ifndef __VISUALIZER_THREADPOOL_H_
+#define __VISUALIZER_THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	a fixed set of worker threads pulling jobs off a shared queue. this is a
+	deliberate copy of the synth library's synth::ThreadPool, kept here so
+	the visualizer builds on its own, with a guard of its own so the two can
+	meet in one translation unit. jobs are run in the order they were
+	submitted, the destructor waits for every job that was already queued to
+	finish.
+	usage: ThreadPool pool(4); pool.submit([] { ... });
+*/
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping;
+
+	void work() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+public:
+	ThreadPool(int threads) {
+		stopping = false;
+		for (int i = 0; i < threads; ++i)
+			workers.emplace_back(&ThreadPool::work, this);
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator = (const ThreadPool&) = delete;
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	int size() const {
+		return workers.size();
+	}
+};
+
+// the parts parallelFor splits its work into for pool: one per worker plus the calling thread
+inline int parallelParts(const ThreadPool* pool) {
+	return pool ? pool->size() + 1 : 1;
+}
+
+/*
+	splits [0, count) into parallelParts(pool) ranges and calls
+	body(begin, end, part) for each, the calling thread doing part 0 and
+	the pool the rest, and returns once all of them are done. part tells the
+	body which per part buffers it may use. without a pool everything runs
+	on the calling thread. not to be called from a job of the same pool.
+*/
+template<class Body>
+void parallelFor(ThreadPool* pool, int count, Body body) {
+	const int parts = parallelParts(pool);
+	if (parts == 1 || count < 2) {
+		body(0, count, 0);
+		return;
+	}
+
+	std::mutex lock;
+	std::condition_variable finished;
+	int running = parts - 1;
+	for (int part = 1; part < parts; ++part) {
+		pool->submit([&, part] {
+			body((long long) count * part / parts, (long long) count * (part + 1) / parts, part);
+			std::lock_guard<std::mutex> guard(lock);
+			if (--running == 0)
+				finished.notify_one();
+		});
+	}
+	body(0, count / parts, 0);
+
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [&] { return running == 0; });
+}
+
+#endif
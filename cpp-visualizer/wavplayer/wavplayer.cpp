@@ -17,7 +17,8 @@
 #include <boost/program_options.hpp>
 
 // My Libraries
-#include "fft.h"
+#include "stft.h"
+#include "threadpool.h"
 
 namespace po = boost::program_options;
 using namespace std;
@@ -27,6 +28,9 @@ int main(int argc, const char** argv) {
     desc.add_options()
         ("help,H", "produce help message")
         ("file,F", po::value< vector<string> >(), "set the file(s) to play.")
+        ("size,S", po::value<int>()->default_value(1024), "samples per fft frame, any size.")
+        ("hop", po::value<int>()->default_value(441), "samples from one fft frame to the next.")
+        ("window,W", po::value<string>()->default_value("hann"), "fft window: rectangular, hann, hamming or blackman.")
     ;
 
     po::positional_options_description p;
@@ -45,6 +49,19 @@ int main(int argc, const char** argv) {
     }
 
     if (vm.count("file")) {
+        StftSettings settings;
+        settings.size = vm["size"].as<int>();
+        settings.hop = vm["hop"].as<int>();
+        string windowName = vm["window"].as<string>();
+        if (windowName == "rectangular") settings.window = Window::RECTANGULAR;
+        else if (windowName == "hann") settings.window = Window::HANN;
+        else if (windowName == "hamming") settings.window = Window::HAMMING;
+        else if (windowName == "blackman") settings.window = Window::BLACKMAN;
+        else {
+            std::cout << "unknown window \'" << windowName << "\'" << std::endl;
+            return -1;
+        }
+        ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
 
         vector<string> files = vm["file"].as< vector<string> >();
         std::cout << "play list: " << std::endl;
@@ -64,6 +81,13 @@ int main(int argc, const char** argv) {
             int channelCount = buffer.getChannelCount();
             int sampleRate = buffer.getSampleRate();
 
+            // the spectrum of every frame of the first channel is worked out before playing starts
+            vector<float> channel(sampleCount / channelCount);
+            for (size_t i = 0; i < channel.size(); ++i) {
+                channel[i] = samples[i * channelCount] / ((float) UINT16_MAX);
+            }
+            Spectrogram spectrogram = stft(channel.data(), channel.size(), settings, &pool);
+
             sf::Sound sound;
             sound.setBuffer(buffer);
             sound.play();
@@ -86,27 +110,20 @@ int main(int argc, const char** argv) {
                     }
                 }
                 
-                // index of the current sample
-                int sampleIndex = sound.getPlayingOffset().asSeconds() * sampleRate * channelCount;
-                
-                const int BUCKETS = 1024;
-                if (sampleIndex + channelCount * BUCKETS > sampleCount) continue ;
-                
-                Complex samplesIn[BUCKETS];
-                Complex fftOut[BUCKETS];
-                for (int i = 0; i < BUCKETS; ++i) {
-                    samplesIn[i] = Complex(samples[sampleIndex + i * channelCount] / ((float) UINT16_MAX), 0);
-                }
+                // the frame starting at the current sample
+                size_t frame = (size_t) (sound.getPlayingOffset().asSeconds() * sampleRate) / settings.hop;
+                if (frame >= spectrogram.frames()) continue ;
 
-                FFT<BUCKETS>::run(samplesIn, fftOut);
+                const float* bins = spectrogram.frame(frame);
+                const int BINS = spectrogram.bins();
 
                 window.clear(sf::Color::Black);
                 float w = window.getSize().x;
                 float h = window.getSize().y;
-                float barWidth = w / ((float) BUCKETS);
+                float barWidth = w / ((float) BINS);
 
-                for (int i = 0; i < BUCKETS; ++i) {
-                    float energy = std::abs(fftOut[i]) / 10.0f;
+                for (int i = 0; i < BINS; ++i) {
+                    float energy = bins[i] / 10.0f;
                     sf::RectangleShape rect;
                     rect.setSize(sf::Vector2f(barWidth, h * energy));
                     rect.setPosition(barWidth * i, h - h * energy);
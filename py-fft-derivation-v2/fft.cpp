@@ -28,9 +28,28 @@ def fft(signal):
 		return combined
 */
 
+/*
+	the recursion above unrolled: the samples are put in bit reversed order
+	once, then the butterflies are done in place from the smallest size up.
+	two radix 2 levels are done at a time as one radix 4 butterfly (plus one
+	radix 2 level first when log2(sampleCount) is odd), so the data is
+	walked half as often. the twiddle factors and the bit reversal swaps of
+	every size are computed on first use and kept, a transform allocates
+	nothing.
+
+	results may be the same array as samples.
+
+	RFFT and IRFFT are the same for real signals. the n real samples are
+	read as n/2 complex ones (even samples real, odd samples imaginary), go
+	through one half size transform, and are then split into the n/2+1 bins
+	that are not mirror images of others.
+*/
+
 #include <complex>
 #include <iostream>
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 const double pi = std::acos(-1);
 
@@ -40,58 +59,188 @@ Complex omega(double p, double q) {
 	return std::exp((2.0 * pi * Complex(0, 1) * q) / p);
 }
 
+// twiddle factors and bit reversal swaps for one size, built once per sampleCount
 template<int sampleCount>
-struct FFT {
-	static void run(Complex* samples, Complex* results) {
-		Complex evenSamples[sampleCount / 2];
-		Complex oddSamples[sampleCount / 2];
-		for (int i = 0; i < sampleCount / 2.0; i++) {
-			evenSamples[i] = samples[i * 2];
-			oddSamples[i] = samples[i * 2 + 1];
-		}
+struct FFTTables {
+	static_assert(sampleCount > 0 && (sampleCount & (sampleCount - 1)) == 0, "the fft size has to be a power of two");
+
+	// the index pairs (i, reverse(i)) with i < reverse(i)
+	std::vector<std::pair<int, int>> swaps;
+	// per radix 4 level with quarter size q: w^j, w^2j, w^3j for j < q, w = omega(4q, -1)
+	std::vector<Complex> twiddles;
+	int firstQuarter; // 1, or 2 when an odd number of levels starts with a radix 2 level
 
-		Complex evenFft[sampleCount / 2];
-		Complex oddFft[sampleCount / 2];
+	FFTTables() {
+		int bits = 0;
+		while ((1 << bits) < sampleCount)
+			++bits;
 
-		FFT<sampleCount/2>::run(evenSamples, evenFft);
-		FFT<sampleCount/2>::run(oddSamples, oddFft);
+		for (int i = 0; i < sampleCount; ++i) {
+			int reversed = 0;
+			for (int b = 0; b < bits; ++b)
+				reversed |= ((i >> b) & 1) << (bits - 1 - b);
+			if (i < reversed)
+				swaps.push_back(std::make_pair(i, reversed));
+		}
 
-		for (int m = 0; m < sampleCount / 2; ++m) {
-			results[m] = evenFft[m] + omega(sampleCount, -m) * oddFft[m];
-			results[m + sampleCount / 2] = evenFft[m] - omega(sampleCount, -m) * oddFft[m];
+		firstQuarter = bits % 2 ? 2 : 1;
+		for (int quarter = firstQuarter; quarter * 4 <= sampleCount; quarter *= 4) {
+			for (int j = 0; j < quarter; ++j) {
+				twiddles.push_back(omega(quarter * 4, -j));
+				twiddles.push_back(omega(quarter * 4, -2 * j));
+				twiddles.push_back(omega(quarter * 4, -3 * j));
+			}
 		}
 	}
+
+	static const FFTTables& get() {
+		static const FFTTables tables;
+		return tables;
+	}
 };
 
-template<>
-struct FFT<1> {
+// a plain complex product, std::complex's operator * also checks for nans and infinities
+inline Complex multiply(const Complex& a, const Complex& b) {
+	return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+// the in place transform, inverse runs it with conjugated twiddles and without the 1/n
+template<int sampleCount, bool inverse>
+void transform(Complex* data) {
+	const FFTTables<sampleCount>& tables = FFTTables<sampleCount>::get();
+
+	for (const std::pair<int, int>& swap : tables.swaps)
+		std::swap(data[swap.first], data[swap.second]);
+
+	if (tables.firstQuarter == 2) {
+		for (int i = 0; i < sampleCount; i += 2) {
+			Complex a = data[i];
+			Complex b = data[i + 1];
+			data[i] = a + b;
+			data[i + 1] = a - b;
+		}
+	}
+
+	const Complex* twiddle = tables.twiddles.data();
+	for (int quarter = tables.firstQuarter; quarter * 4 <= sampleCount; quarter *= 4) {
+		for (int i = 0; i < sampleCount; i += quarter * 4) {
+			Complex* x = data + i;
+			for (int j = 0; j < quarter; ++j) {
+				Complex w1 = inverse ? std::conj(twiddle[3 * j]) : twiddle[3 * j];
+				Complex w2 = inverse ? std::conj(twiddle[3 * j + 1]) : twiddle[3 * j + 1];
+				Complex w3 = inverse ? std::conj(twiddle[3 * j + 2]) : twiddle[3 * j + 2];
+
+				// after bit reversal the even half of each sub transform comes first
+				Complex a = x[j];
+				Complex b = multiply(x[j + quarter], w2);
+				Complex c = multiply(x[j + 2 * quarter], w1);
+				Complex d = multiply(x[j + 3 * quarter], w3);
+
+				Complex sum = a + b;
+				Complex difference = a - b;
+				Complex cd = c + d;
+				// (c - d) turned by -i, or by +i for the inverse
+				Complex turned = inverse ? Complex(-(c - d).imag(), (c - d).real()) : Complex((c - d).imag(), -(c - d).real());
+
+				x[j] = sum + cd;
+				x[j + quarter] = difference + turned;
+				x[j + 2 * quarter] = sum - cd;
+				x[j + 3 * quarter] = difference - turned;
+			}
+		}
+		twiddle += 3 * quarter;
+	}
+}
+
+template<int sampleCount>
+struct FFT {
 	static void run(Complex* samples, Complex* results) {
-		results[0] = samples[0];
+		if (results != samples)
+			std::copy(samples, samples + sampleCount, results);
+		transform<sampleCount, false>(results);
 	}
 };
 
-// taken from rosetta code
 template<int sampleCount>
 struct IFFT {
-	static void run(Complex* _fft, Complex* result) {
-		Complex fft[sampleCount];
-		memcpy(fft, _fft, sizeof(Complex) * sampleCount);
+	static void run(Complex* fft, Complex* result) {
+		if (result != fft)
+			std::copy(fft, fft + sampleCount, result);
+		transform<sampleCount, true>(result);
+		for (int i = 0; i < sampleCount; ++i)
+			result[i] /= (double) sampleCount;
+	}
+};
+
+// the twiddles omega(n, -k), k <= n/4, that split a half size transform into the bins of a real one
+template<int sampleCount>
+struct RFFTTables {
+	static_assert(sampleCount >= 2 && (sampleCount & (sampleCount - 1)) == 0, "the real fft size has to be a power of two, at least 2");
+
+	std::vector<Complex> twiddles;
+
+	RFFTTables() {
+		for (int k = 0; k <= sampleCount / 4; ++k)
+			twiddles.push_back(omega(sampleCount, -k));
+	}
 
-		std::transform(fft, fft + sampleCount, fft, [](Complex val) -> Complex {
-			return std::conj(val);
-		});
+	static const RFFTTables& get() {
+		static const RFFTTables tables;
+		return tables;
+	}
+};
 
-		FFT<sampleCount>::run(fft, fft);
+// sampleCount real samples to the bins 0..sampleCount/2, bins holds sampleCount/2 + 1 values
+template<int sampleCount>
+struct RFFT {
+	static void run(const double* samples, Complex* bins) {
+		const int half = sampleCount / 2;
+		const RFFTTables<sampleCount>& tables = RFFTTables<sampleCount>::get();
 
-		std::transform(fft, fft + sampleCount, fft, [](Complex val) -> Complex {
-			return std::conj(val);
-		});
+		for (int k = 0; k < half; ++k)
+			bins[k] = Complex(samples[2 * k], samples[2 * k + 1]);
+		transform<half, false>(bins);
 
-		std::transform(fft, fft + sampleCount, fft, [](Complex val) -> Complex {
-			return val / ((double) sampleCount);
-		});
+		// z[k] holds the transforms of the even (e) and odd (o) samples mixed together,
+		// x[k] = e[k] + w^k o[k] and x[half - k] = conj(e[k] - w^k o[k])
+		Complex z0 = bins[0];
+		bins[0] = Complex(z0.real() + z0.imag(), 0);
+		bins[half] = Complex(z0.real() - z0.imag(), 0);
+		for (int k = 1; k <= half / 2; ++k) {
+			Complex a = bins[k];
+			Complex b = std::conj(bins[half - k]);
+			Complex even = (a + b) * 0.5;
+			Complex odd = multiply(a - b, Complex(0, -0.5));
+			Complex turned = multiply(tables.twiddles[k], odd);
+			bins[k] = even + turned;
+			bins[half - k] = std::conj(even - turned);
+		}
+	}
+};
+
+// the bins 0..sampleCount/2 back to sampleCount real samples
+template<int sampleCount>
+struct IRFFT {
+	static void run(const Complex* bins, double* samples) {
+		const int half = sampleCount / 2;
+		const RFFTTables<sampleCount>& tables = RFFTTables<sampleCount>::get();
+		// a complex is two doubles (real first), so the samples are the half size transform's buffer
+		Complex* z = reinterpret_cast<Complex*>(samples);
+
+		z[0] = Complex(bins[0].real() + bins[half].real(), bins[0].real() - bins[half].real()) * 0.5;
+		for (int k = 1; k <= half / 2; ++k) {
+			Complex a = bins[k];
+			Complex b = std::conj(bins[half - k]);
+			Complex even = (a + b) * 0.5;
+			Complex odd = multiply(a - b, std::conj(tables.twiddles[k])) * 0.5;
+			Complex turned = Complex(-odd.imag(), odd.real());
+			z[k] = even + turned;
+			z[half - k] = std::conj(even - turned);
+		}
 
-		memcpy(result, fft, sizeof(fft));
+		transform<half, true>(z);
+		for (int k = 0; k < half; ++k)
+			z[k] /= (double) half;
 	}
 };
 